@@ -5,5 +5,6 @@
 # include "queue.h"
 # include "stack.h"
 # include "memory.h"
+# include "stats.h"
 
 #endif /* _CHATS_COMMON_ALL_H_ */
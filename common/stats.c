@@ -0,0 +1,41 @@
+#include "stats.h"
+#include <stddef.h>
+#include <time.h>
+
+void histogram_add(atomic_histogram_t *h, uint64_t value) {
+    size_t idx = value ? 63 - __builtin_clzll(value) : 0;
+
+    if (idx >= HISTOGRAM_BUCKETS) idx = HISTOGRAM_BUCKETS - 1;
+
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(h->bucket + idx, 1, memory_order_relaxed);
+}
+
+void histogram_fetch(atomic_histogram_t *h, histogram_t *out) {
+    size_t idx;
+
+    out->count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    out->sum = atomic_load_explicit(&h->sum, memory_order_relaxed);
+
+    for (idx = 0; idx < HISTOGRAM_BUCKETS; ++idx)
+        out->bucket[idx] = atomic_load_explicit(h->bucket + idx,
+                                                memory_order_relaxed);
+}
+
+void atomic_max(atomic_ullong *v, unsigned long long value) {
+    unsigned long long max = atomic_load_explicit(v, memory_order_relaxed);
+
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(v, &max, value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed));
+}
+
+uint64_t now_nsec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,37 @@
+#ifndef _CHATS_COMMON_STATS_H_
+# define _CHATS_COMMON_STATS_H_
+
+# include <stdint.h>
+# include <stdatomic.h>
+
+# define HISTOGRAM_BUCKETS 32
+
+/** Histogram with power of two buckets
+ * Bucket \c i counts values in [2^i, 2^(i+1)), bucket 0 counts 0 also.
+ * The last bucket counts everything above.
+ */
+typedef struct histogram {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long bucket[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/** Histogram which may be updated from several threads
+ */
+typedef struct atomic_histogram {
+    atomic_ullong count;
+    atomic_ullong sum;
+    atomic_ullong bucket[HISTOGRAM_BUCKETS];
+} atomic_histogram_t;
+
+void histogram_add(atomic_histogram_t *h, uint64_t value);
+/** Take snapshot of histogram, fields are loaded one by one */
+void histogram_fetch(atomic_histogram_t *h, histogram_t *out);
+
+/** Raise \c v to \c value if it is less */
+void atomic_max(atomic_ullong *v, unsigned long long value);
+
+/** Monotonic clock in nanoseconds */
+uint64_t now_nsec(void);
+
+#endif /* _CHATS_COMMON_STATS_H_ */
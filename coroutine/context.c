@@ -0,0 +1,38 @@
+#include "context.h"
+#include "memory.h"
+
+#include <stddef.h>
+#include <ucontext.h>
+
+struct co_context {
+    ucontext_t uc;
+};
+
+co_context_t *co_context_init(void *stack, size_t stack_size,
+                              co_context_entry_t entry) {
+    co_context_t *ctx = allocate(sizeof(co_context_t));
+
+    if (!ctx) return NULL;
+
+    if (!entry) return ctx;
+
+    if (getcontext(&ctx->uc)) {
+        deallocate(ctx);
+        return NULL;
+    }
+
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = stack_size;
+    ctx->uc.uc_link = NULL;
+    makecontext(&ctx->uc, entry, 0);
+
+    return ctx;
+}
+
+void co_context_deinit(co_context_t *ctx) {
+    deallocate(ctx);
+}
+
+void co_context_switch(co_context_t *from, co_context_t *to) {
+    swapcontext(&from->uc, &to->uc);
+}
@@ -0,0 +1,25 @@
+#ifndef _COROUTINE_CONTEXT_H_
+# define _COROUTINE_CONTEXT_H_
+
+# include <stddef.h>
+
+/* Execution context of coroutine.
+ * ucontext.h is kept out of the rest of the library as its stack_t
+ * conflicts with the one of common/stack.h.
+ */
+
+struct co_context;
+typedef struct co_context co_context_t;
+
+typedef void (*co_context_entry_t)(void);
+
+/** Context to start entry on the stack given
+ * Context for saving of a switching one is created if \c entry is \c NULL.
+ */
+co_context_t *co_context_init(void *stack, size_t stack_size,
+                              co_context_entry_t entry);
+void co_context_deinit(co_context_t *ctx);
+/** Save current context to \c from and switch to \c to */
+void co_context_switch(co_context_t *from, co_context_t *to);
+
+#endif /* _COROUTINE_CONTEXT_H_ */
@@ -1 +1,270 @@
-#include "coroutine.h"
\ No newline at end of file
+#include "coroutine.h"
+#include "context.h"
+#include "common.h"
+#include "io-service.h"
+#include "timer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* A coroutine switches to its resumer telling what it waits for and the
+ * resumer parks it. Parking from the coroutine stack would let another
+ * thread resume the coroutine before it is switched out.
+ */
+
+typedef enum co_park {
+    CO_PARK_NONE,
+    CO_PARK_READ,
+    CO_PARK_WRITE,
+    CO_PARK_SLEEP,
+    CO_PARK_YIELD,
+    CO_PARK_DONE
+} co_park_t;
+
+struct coroutine {
+    io_service_t *iosvc;
+    co_function_t fn;
+    void *ctx;
+    co_context_t *context;
+    /* context of the resumer, valid while the coroutine runs */
+    co_context_t *caller;
+    /* mapping of the stack with guard page at its low end */
+    void *stack;
+    size_t stack_size;
+    /* created on first sleep */
+    tmr_t *timer;
+    /* what the coroutine waits for when switched out */
+    co_park_t park;
+    int fd;
+    uint64_t nsec;
+    /* what the coroutine waited for has happened */
+    bool resumed;
+};
+
+static _Thread_local coroutine_t *current = NULL;
+
+static void co_resume(coroutine_t *co, bool resumed);
+
+static
+void co_task(void *ctx) {
+    co_resume(ctx, true);
+}
+
+static
+void co_io_job(int fd, io_svc_op_t op, void *ctx) {
+    co_resume(ctx, true);
+}
+
+static
+void co_timer_job(void *ctx) {
+    co_resume(ctx, true);
+}
+
+/* Map stack of at least size bytes rounded up to pages with inaccessible
+ * page below it, so that overflow faults instead of corrupting the heap.
+ * Returns the usable stack.
+ */
+static
+void *co_stack_map(coroutine_t *co, size_t *size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    void *stack;
+
+    *size = (*size + page - 1) & ~(page - 1);
+
+    stack = mmap(NULL, *size + page, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) return NULL;
+
+    if (mprotect(stack, page, PROT_NONE)) {
+        munmap(stack, *size + page);
+        return NULL;
+    }
+
+    co->stack = stack;
+    co->stack_size = *size + page;
+
+    return (char *)stack + page;
+}
+
+static
+void co_free(coroutine_t *co) {
+    if (co->timer) timer_deinit(co->timer);
+
+    if (co->context) co_context_deinit(co->context);
+    if (co->caller) co_context_deinit(co->caller);
+
+    if (co->stack) munmap(co->stack, co->stack_size);
+    deallocate(co);
+}
+
+/* Called on the resumer stack, co may be resumed by other thread as soon
+ * as it is parked. Returns false if nothing is going to resume it.
+ */
+static
+bool co_park(coroutine_t *co) {
+    switch (co->park) {
+        case CO_PARK_READ:
+            return io_service_post_job(co->iosvc, co->fd, IO_SVC_OP_READ, true,
+                                       co_io_job, co);
+
+        case CO_PARK_WRITE:
+            return io_service_post_job(co->iosvc, co->fd, IO_SVC_OP_WRITE,
+                                       true, co_io_job, co);
+
+        case CO_PARK_SLEEP:
+            return timer_set_deadline(co->timer,
+                                      co->nsec / 1000000000ULL,
+                                      co->nsec % 1000000000ULL,
+                                      co_timer_job, co);
+
+        case CO_PARK_YIELD:
+            return io_service_post_task(co->iosvc, co_task, co);
+
+        case CO_PARK_DONE:
+            co_free(co);
+            return true;
+
+        case CO_PARK_NONE:
+            break;
+    }
+
+    return true;
+}
+
+/* coroutine which can not be parked is resumed at once with failure */
+static
+void co_resume(coroutine_t *co, bool resumed) {
+    coroutine_t *prev = current;
+
+    do {
+        current = co;
+        co->park = CO_PARK_NONE;
+        co->resumed = resumed;
+
+        co_context_switch(co->caller, co->context);
+
+        current = prev;
+        resumed = false;
+    } while (!co_park(co));
+}
+
+/* Switch to the resumer. Current coroutine should be fetched before the
+ * switch only as the thread may change.
+ * Returns false if the coroutine could not be parked.
+ */
+static
+bool co_switch_out(coroutine_t *co, co_park_t park) {
+    co->park = park;
+    co_context_switch(co->context, co->caller);
+
+    return co->resumed;
+}
+
+static
+void co_entry(void) {
+    coroutine_t *co = current;
+
+    (*co->fn)(co->ctx);
+
+    co_switch_out(co, CO_PARK_DONE);
+}
+
+bool co_spawn(io_service_t *iosvc, co_function_t fn, void *ctx,
+              size_t stack_size) {
+    coroutine_t *co;
+    void *stack;
+
+    if (!iosvc || !fn) return false;
+    if (!stack_size) stack_size = COROUTINE_DEFAULT_STACK_SIZE;
+
+    co = allocate(sizeof(coroutine_t));
+    if (!co) return false;
+
+    co->timer = NULL;
+    co->context = co->caller = NULL;
+    co->stack = NULL;
+    stack = co_stack_map(co, &stack_size);
+
+    if (!stack) {
+        co_free(co);
+        return false;
+    }
+
+    co->context = co_context_init(stack, stack_size, co_entry);
+    co->caller = co_context_init(NULL, 0, NULL);
+
+    if (!co->context || !co->caller) {
+        co_free(co);
+        return false;
+    }
+
+    co->iosvc = iosvc;
+    co->fn = fn;
+    co->ctx = ctx;
+    co->park = CO_PARK_NONE;
+    co->fd = -1;
+    co->nsec = 0;
+    co->resumed = false;
+
+    /* the coroutine may be done and freed by the time this returns */
+    if (!io_service_post_task(iosvc, co_task, co)) {
+        co_free(co);
+        return false;
+    }
+
+    return true;
+}
+
+coroutine_t *co_self(void) {
+    return current;
+}
+
+io_service_t *co_service(coroutine_t *co) {
+    return co ? co->iosvc : NULL;
+}
+
+bool co_await_read(int fd) {
+    coroutine_t *co = current;
+
+    if (!co || fd < 0) return false;
+
+    co->fd = fd;
+    return co_switch_out(co, CO_PARK_READ);
+}
+
+bool co_await_write(int fd) {
+    coroutine_t *co = current;
+
+    if (!co || fd < 0) return false;
+
+    co->fd = fd;
+    return co_switch_out(co, CO_PARK_WRITE);
+}
+
+bool co_sleep(uint64_t nsec) {
+    coroutine_t *co = current;
+
+    if (!co) return false;
+
+    if (!co->timer) co->timer = timer_init(co->iosvc);
+
+    /* no timer, let others run at least */
+    if (!co->timer) {
+        co_switch_out(co, CO_PARK_YIELD);
+        return false;
+    }
+
+    co->nsec = nsec;
+    return co_switch_out(co, CO_PARK_SLEEP);
+}
+
+bool co_yield(void) {
+    coroutine_t *co = current;
+
+    if (!co) return false;
+
+    return co_switch_out(co, CO_PARK_YIELD);
+}
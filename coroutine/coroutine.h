@@ -1,2 +1,56 @@
 #ifndef _COROUTINE_H_
-#endif /* _COROUTINE_H_ */
\ No newline at end of file
+# define _COROUTINE_H_
+
+# include "io-service.h"
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+/* Stackful coroutines run by io_service.
+ * A coroutine is parked on an io_service job or a timer while it awaits
+ * and is resumed by a thread running the service, not necessarily the
+ * one it was parked by. Thus thread local data should not be relied upon
+ * across awaits.
+ */
+
+# define COROUTINE_DEFAULT_STACK_SIZE (64 * 1024)
+
+struct coroutine;
+typedef struct coroutine coroutine_t;
+
+typedef void (*co_function_t)(void *ctx);
+
+/** Spawn coroutine to be run by the service
+ * Coroutine is started as a task of the service and is destroyed once
+ * \c fn returns. The coroutine may refer to itself with \c co_self.
+ * \param [in] stack_size stack size, default one is used for 0. It is
+ *            rounded up to pages, overflow hits a guard page below.
+ * \return \c false if the service is stopped or no memory is available
+ */
+bool co_spawn(io_service_t *iosvc, co_function_t fn, void *ctx,
+              size_t stack_size);
+/** Coroutine being run by the thread, \c NULL outside of coroutines */
+coroutine_t *co_self(void);
+io_service_t *co_service(coroutine_t *co);
+
+/* Functions below return \c false immediately if called outside of a
+ * coroutine. They also return \c false without waiting if the coroutine
+ * can not be parked: the service does not accept new jobs or, for fd, a
+ * job of the same operation is posted for it already.
+ * Coroutine parked when the service is stopped without waiting for pending
+ * jobs is never resumed.
+ */
+/** Park until fd is ready for reading */
+bool co_await_read(int fd);
+/** Park until fd is ready for writing */
+bool co_await_write(int fd);
+/** Park for at least nsec, with precision of a timer
+ * \return \c false also if no timer could be created, the coroutine
+ *         yields then
+ */
+bool co_sleep(uint64_t nsec);
+/** Let other jobs of the service run */
+bool co_yield(void);
+
+#endif /* _COROUTINE_H_ */
@@ -0,0 +1,127 @@
+#include "io-service-internal.h"
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <sys/epoll.h>
+
+static
+bool epoll_backend_init(io_service_t *iosvc) {
+    iosvc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (iosvc->epoll_fd < 0) return false;
+
+    memset(&iosvc->event_fd_event, 0, sizeof(iosvc->event_fd_event));
+
+    /* event fd is distinguished by NULL data pointer.
+     * It is oneshot one so that single runner handles single notification.
+     */
+    iosvc->event_fd_event.events = EPOLLIN | EPOLLONESHOT;
+    iosvc->event_fd_event.data.ptr = NULL;
+
+    if (epoll_ctl(iosvc->epoll_fd, EPOLL_CTL_ADD,
+                  iosvc->event_fd, &iosvc->event_fd_event)) {
+        close(iosvc->epoll_fd);
+        iosvc->epoll_fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+static
+void epoll_backend_deinit(io_service_t *iosvc) {
+    close(iosvc->epoll_fd);
+    iosvc->epoll_fd = -1;
+}
+
+static
+int epoll_backend_ctl(io_service_t *iosvc, int op, int fd,
+                      struct epoll_event *event) {
+    atomic_fetch_add_explicit(&iosvc->stats.ctl_calls, 1,
+                              memory_order_relaxed);
+    return epoll_ctl(iosvc->epoll_fd, op, fd, event);
+}
+
+static
+void epoll_backend_sync(io_service_t *iosvc, lookup_table_element_t *lte) {
+    struct epoll_event event;
+    uint32_t armed;
+
+    if (lte->events == 0) {
+        if (lte->in_epoll)
+            epoll_backend_ctl(iosvc, EPOLL_CTL_DEL, lte->fd, NULL);
+
+        iosvc_lookup_table_release(iosvc, lte);
+        return;
+    }
+
+    armed = lte->events | (lte->edge ? EPOLLET : 0);
+
+    /* registration is still armed for the very same events */
+    if (lte->in_epoll && lte->armed == armed) {
+        atomic_fetch_add_explicit(&iosvc->stats.ctl_skipped, 1,
+                                  memory_order_relaxed);
+        return;
+    }
+
+    event.events = lte->events | (lte->edge ? EPOLLET : EPOLLONESHOT);
+    event.data.ptr = lte;
+    lte->armed = armed;
+
+    if (lte->in_epoll) {
+        if (!epoll_backend_ctl(iosvc, EPOLL_CTL_MOD, lte->fd, &event))
+            return;
+
+        if (errno != ENOENT) return;
+    }
+
+    lte->in_epoll =
+        !epoll_backend_ctl(iosvc, EPOLL_CTL_ADD, lte->fd, &event);
+}
+
+/* changes are applied by the runner which receives the notification.
+ * Registration of the element without jobs is dropped right away as the
+ * fd may be closed and reused before the runner syncs. Kernel drops
+ * the registration on close, while the element would look armed still.
+ */
+static
+void epoll_backend_update(io_service_t *iosvc, lookup_table_element_t *lte) {
+    if (lte->events == 0) {
+        epoll_backend_sync(iosvc, lte);
+        return;
+    }
+
+    iosvc_lookup_table_queue(iosvc, lte);
+}
+
+static
+void epoll_backend_notified(io_service_t *iosvc) {
+    iosvc_lookup_table_sync_queued(iosvc);
+}
+
+static
+void epoll_backend_rearm_notification(io_service_t *iosvc) {
+    epoll_ctl(iosvc->epoll_fd, EPOLL_CTL_MOD,
+              iosvc->event_fd, &iosvc->event_fd_event);
+}
+
+static
+int epoll_backend_wait(io_service_t *iosvc,
+                       struct epoll_event *events, size_t max_events,
+                       int timeout) {
+    return epoll_wait(iosvc->epoll_fd, events, max_events, timeout);
+}
+
+const io_service_backend_ops_t IO_SVC_EPOLL_OPS = {
+    .init = epoll_backend_init,
+    .deinit = epoll_backend_deinit,
+    .sync = epoll_backend_sync,
+    .update = epoll_backend_update,
+    .notified = epoll_backend_notified,
+    .rearm_notification = epoll_backend_rearm_notification,
+    .wait = epoll_backend_wait,
+    .submit = NULL,
+    .edge_triggered = true
+};
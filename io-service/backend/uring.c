@@ -0,0 +1,856 @@
+#ifdef IO_SERVICE_WITH_URING
+
+#include "io-service-internal.h"
+#include "memory.h"
+#include "stats.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* io_uring backend.
+ * Readiness is tracked with oneshot IORING_OP_POLL_ADD requests, one per
+ * element at most. Requests are queued to submission ring and submitted
+ * along with the wait for completions. If some runner is blocked in kernel
+ * already, requests are submitted right away.
+ * Only one runner (leader) waits for and reaps completions at a time.
+ * Submitted operations are passed to the kernel as they are. Fixed buffer
+ * reads use a pool of buffers registered with the kernel at init.
+ * Elements which could not be armed as the submission ring is full are
+ * queued and armed again by a runner once notified.
+ * Requests still in kernel at deinit are cancelled and waited for, up to
+ * URING_DRAIN_NSEC.
+ */
+
+#define URING_MIN_ENTRIES           256
+/* user data of requests which completions are of no interest */
+#define URING_IGNORE_TAG            ((uint64_t)0)
+/* user data of notification event fd poll request */
+#define URING_NOTIFICATION_TAG      ((uint64_t)1)
+/* deinit waits this long for cancelled requests at most */
+#define URING_DRAIN_NSEC            (1000000000ULL)
+/* completions are polled this often if enter does not take a timeout */
+#define URING_DRAIN_POLL_USEC       1000
+
+typedef struct uring {
+    int fd;
+
+    struct {
+        unsigned *head;
+        unsigned *tail;
+        unsigned *mask;
+        unsigned *entries;
+        unsigned *flags;
+        unsigned *array;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+        void *ring;
+        size_t ring_size;
+    } sq;
+
+    struct {
+        unsigned *head;
+        unsigned *tail;
+        unsigned *mask;
+        unsigned *overflow;
+        struct io_uring_cqe *cqes;
+        void *ring;
+        size_t ring_size;
+    } cq;
+
+    /* guards submission ring, fixed buffers, requests list and the fields
+     * below
+     */
+    pthread_mutex_t sq_mutex;
+    /* some runner is blocked in kernel waiting for completions */
+    bool waiting;
+    bool notification_armed;
+    /* submitted operations in kernel */
+    iosvc_request_t *requests;
+    /* elements with poll request in kernel, counted on sync while closing */
+    size_t armed;
+    /* enter takes timeout for completions */
+    bool ext_arg;
+    /* every element should be armed anew, completions were dropped */
+    bool rearm_all;
+    /* the service is being deinited, elements are disarmed on sync */
+    bool closing;
+
+    struct {
+        void *data;
+        size_t size;
+        /* stack of vacant buffer indices */
+        int *vacant;
+        size_t vacant_count;
+    } fixed;
+
+    /* guards completion ring and the fields below, held by leader */
+    pthread_mutex_t cq_mutex;
+    /* last seen count of completions dropped by kernel */
+    unsigned overflow;
+} uring_t;
+
+static
+int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+/* count of queued but not submitted requests. Called with sq_mutex locked. */
+static
+unsigned uring_pending(uring_t *ring) {
+    return *ring->sq.tail - __atomic_load_n(ring->sq.head, __ATOMIC_ACQUIRE);
+}
+
+/* submit queued requests and wait for a completion up to nsec.
+ * Called with cq_mutex locked.
+ */
+static
+void uring_enter_timeout(uring_t *ring, uint64_t nsec) {
+    unsigned to_submit;
+
+    pthread_mutex_lock(&ring->sq_mutex);
+    to_submit = uring_pending(ring);
+    pthread_mutex_unlock(&ring->sq_mutex);
+
+#ifdef IORING_ENTER_EXT_ARG
+    if (ring->ext_arg) {
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+
+        ts.tv_sec = (long long)(nsec / 1000000000ULL);
+        ts.tv_nsec = (long long)(nsec % 1000000000ULL);
+
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uintptr_t)&ts;
+
+        syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+                IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                &arg, sizeof(arg));
+        return;
+    }
+#endif
+
+    uring_enter(ring->fd, to_submit, 0, IORING_ENTER_GETEVENTS);
+
+    if (nsec > URING_DRAIN_POLL_USEC * 1000ULL)
+        nsec = URING_DRAIN_POLL_USEC * 1000ULL;
+
+    usleep((useconds_t)(nsec / 1000));
+}
+
+/* fetch vacant submission entry. Called with sq_mutex locked. */
+static
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    unsigned tail = *ring->sq.tail;
+    struct io_uring_sqe *sqe;
+
+    if (uring_pending(ring) >= *ring->sq.entries) {
+        /* let the kernel consume the ring */
+        uring_enter(ring->fd, uring_pending(ring), 0, 0);
+
+        if (uring_pending(ring) >= *ring->sq.entries) return NULL;
+    }
+
+    sqe = ring->sq.sqes + (tail & *ring->sq.mask);
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+/* publish the entry fetched with uring_get_sqe.
+ * Called with sq_mutex locked.
+ */
+static
+void uring_commit_sqe(uring_t *ring) {
+    unsigned tail = *ring->sq.tail;
+
+    ring->sq.array[tail & *ring->sq.mask] = tail & *ring->sq.mask;
+    __atomic_store_n(ring->sq.tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* queue poll request for fd.
+ * Called with sq_mutex locked.
+ */
+static
+bool uring_poll_add(uring_t *ring, int fd, uint32_t events,
+                    uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (!sqe) return false;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+
+    uring_commit_sqe(ring);
+
+    return true;
+}
+
+/* queue removal of poll request with user data.
+ * Called with sq_mutex locked.
+ */
+static
+bool uring_poll_remove(uring_t *ring, uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (!sqe) return false;
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = URING_IGNORE_TAG;
+
+    uring_commit_sqe(ring);
+
+    return true;
+}
+
+/* queue cancellation of operation with user data.
+ * Called with sq_mutex locked.
+ */
+static
+bool uring_cancel(uring_t *ring, uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (!sqe) return false;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = URING_IGNORE_TAG;
+
+    uring_commit_sqe(ring);
+
+    return true;
+}
+
+/* requests list, called with sq_mutex locked */
+static
+void uring_request_link(uring_t *ring, iosvc_request_t *req) {
+    req->cancelling = false;
+    req->prev = NULL;
+    req->next = ring->requests;
+    if (ring->requests) ring->requests->prev = req;
+    ring->requests = req;
+}
+
+static
+void uring_request_unlink(uring_t *ring, iosvc_request_t *req) {
+    if (req->prev) req->prev->next = req->next;
+    else ring->requests = req->next;
+
+    if (req->next) req->next->prev = req->prev;
+}
+
+/* submit queued requests if leader would not do it soon.
+ * Called with sq_mutex locked.
+ */
+static
+void uring_kick(uring_t *ring) {
+    if (ring->waiting)
+        uring_enter(ring->fd, uring_pending(ring), 0, 0);
+}
+
+/* register pool of fixed buffers. Pool is left empty on failure. */
+static
+void uring_fixed_init(io_service_t *iosvc, uring_t *ring) {
+    struct iovec iov;
+    size_t idx;
+
+    ring->fixed.size = iosvc->fixed_buffer_size;
+    ring->fixed.vacant_count = 0;
+    ring->fixed.data = allocate(iosvc->fixed_buffers * ring->fixed.size);
+    ring->fixed.vacant = allocate(iosvc->fixed_buffers * sizeof(int));
+
+    if (!ring->fixed.data || !ring->fixed.vacant) return;
+
+    iov.iov_base = ring->fixed.data;
+    iov.iov_len = iosvc->fixed_buffers * ring->fixed.size;
+
+    if (syscall(__NR_io_uring_register, ring->fd,
+                IORING_REGISTER_BUFFERS, &iov, 1))
+        return;
+
+    for (idx = 0; idx < iosvc->fixed_buffers; ++idx)
+        ring->fixed.vacant[idx] = (int)(iosvc->fixed_buffers - idx - 1);
+
+    ring->fixed.vacant_count = iosvc->fixed_buffers;
+}
+
+static
+void uring_fixed_deinit(uring_t *ring) {
+    deallocate(ring->fixed.data);
+    deallocate(ring->fixed.vacant);
+}
+
+static
+void *uring_fixed_buffer(uring_t *ring, int slot) {
+    return ring->fixed.data + (size_t)slot * ring->fixed.size;
+}
+
+static
+void uring_unmap(uring_t *ring) {
+    if (ring->sq.sqes)
+        munmap(ring->sq.sqes, ring->sq.sqes_size);
+
+    if (ring->cq.ring && ring->cq.ring != ring->sq.ring)
+        munmap(ring->cq.ring, ring->cq.ring_size);
+
+    if (ring->sq.ring)
+        munmap(ring->sq.ring, ring->sq.ring_size);
+}
+
+static
+bool uring_map(uring_t *ring, struct io_uring_params *p) {
+    ring->sq.ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    ring->cq.ring_size = p->cq_off.cqes +
+                         p->cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq.ring_size > ring->sq.ring_size)
+            ring->sq.ring_size = ring->cq.ring_size;
+        ring->cq.ring_size = ring->sq.ring_size;
+    }
+
+    ring->sq.ring = mmap(NULL, ring->sq.ring_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq.ring == MAP_FAILED) {
+        ring->sq.ring = NULL;
+        return false;
+    }
+
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq.ring = ring->sq.ring;
+    else {
+        ring->cq.ring = mmap(NULL, ring->cq.ring_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq.ring == MAP_FAILED) {
+            ring->cq.ring = NULL;
+            return false;
+        }
+    }
+
+    ring->sq.sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq.sqes = mmap(NULL, ring->sq.sqes_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQES);
+    if (ring->sq.sqes == MAP_FAILED) {
+        ring->sq.sqes = NULL;
+        return false;
+    }
+
+    ring->sq.head = ring->sq.ring + p->sq_off.head;
+    ring->sq.tail = ring->sq.ring + p->sq_off.tail;
+    ring->sq.mask = ring->sq.ring + p->sq_off.ring_mask;
+    ring->sq.entries = ring->sq.ring + p->sq_off.ring_entries;
+    ring->sq.flags = ring->sq.ring + p->sq_off.flags;
+    ring->sq.array = ring->sq.ring + p->sq_off.array;
+
+    ring->cq.head = ring->cq.ring + p->cq_off.head;
+    ring->cq.tail = ring->cq.ring + p->cq_off.tail;
+    ring->cq.mask = ring->cq.ring + p->cq_off.ring_mask;
+    ring->cq.overflow = ring->cq.ring + p->cq_off.overflow;
+    ring->cq.cqes = ring->cq.ring + p->cq_off.cqes;
+
+    return true;
+}
+
+static
+bool uring_backend_init(io_service_t *iosvc) {
+    struct io_uring_params params;
+    uring_t *ring;
+    unsigned entries = URING_MIN_ENTRIES;
+    int err;
+
+    while (entries < iosvc->max_events) entries <<= 1;
+
+    ring = allocate(sizeof(uring_t));
+    if (!ring) return false;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        err = errno;
+        deallocate(ring);
+        errno = err == EPERM ? ENOSYS : err;
+        return false;
+    }
+
+    if (!uring_map(ring, &params)) {
+        err = errno;
+        uring_unmap(ring);
+        close(ring->fd);
+        deallocate(ring);
+        errno = err;
+        return false;
+    }
+
+    pthread_mutex_init(&ring->sq_mutex, NULL);
+    pthread_mutex_init(&ring->cq_mutex, NULL);
+
+    ring->waiting = false;
+    ring->notification_armed = false;
+    ring->requests = NULL;
+    ring->armed = 0;
+    ring->rearm_all = ring->closing = false;
+    ring->overflow = *ring->cq.overflow;
+#ifdef IORING_FEAT_EXT_ARG
+    ring->ext_arg = params.features & IORING_FEAT_EXT_ARG;
+#endif
+
+    uring_fixed_init(iosvc, ring);
+
+    iosvc->backend_data = ring;
+
+    iosvc->ops->rearm_notification(iosvc);
+
+    return true;
+}
+
+static size_t uring_reap(uring_t *ring,
+                         struct epoll_event *events, size_t max_events);
+
+/* Cancel everything in kernel and wait for completions, so that neither
+ * the requests nor buffers are used by kernel once freed.
+ * Callbacks of cancelled operations are called with the result.
+ * Cancellation which did not fit the submission ring is queued again and
+ * completions dropped on overflow never come, thus only what is still
+ * outstanding is waited for and for URING_DRAIN_NSEC at most.
+ * \return \c false if some request may still be in kernel
+ */
+static
+bool uring_drain(io_service_t *iosvc, uring_t *ring) {
+    struct epoll_event events[URING_MIN_ENTRIES];
+    lookup_table_element_t *lte;
+    iosvc_request_t *req;
+    uint64_t now, deadline = now_nsec() + URING_DRAIN_NSEC;
+    size_t count, idx;
+    unsigned overflow;
+    bool outstanding;
+
+    pthread_mutex_lock(&ring->sq_mutex);
+
+    ring->closing = true;
+
+    if (ring->notification_armed)
+        uring_poll_remove(ring, URING_NOTIFICATION_TAG);
+
+    pthread_mutex_unlock(&ring->sq_mutex);
+
+    for (;;) {
+        pthread_mutex_lock(&ring->sq_mutex);
+
+        for (req = ring->requests; req; req = req->next)
+            if (!req->cancelling)
+                req->cancelling =
+                    uring_cancel(ring, (uintptr_t)req | IOSVC_REQUEST_TAG);
+
+        ring->armed = 0;
+
+        pthread_mutex_unlock(&ring->sq_mutex);
+
+        /* armed elements are counted and disarmed on sync while closing */
+        iosvc_lookup_table_sync_all(iosvc);
+
+        pthread_mutex_lock(&ring->sq_mutex);
+        outstanding = ring->requests || ring->armed;
+        pthread_mutex_unlock(&ring->sq_mutex);
+
+        now = now_nsec();
+        if (!outstanding || now >= deadline) break;
+
+        pthread_mutex_lock(&ring->cq_mutex);
+
+        uring_enter_timeout(ring, deadline - now);
+
+        while ((count = uring_reap(ring, events, URING_MIN_ENTRIES)))
+            for (idx = 0; idx < count; ++idx) {
+                if (events[idx].data.ptr == NULL) continue;
+
+                if (events[idx].data.u64 & IOSVC_REQUEST_TAG) {
+                    req = (void *)(uintptr_t)(events[idx].data.u64 &
+                                              ~IOSVC_REQUEST_TAG);
+                    (*req->cb)(req->fd, req->op, req->res, req->ctx);
+                    deallocate(req);
+                    continue;
+                }
+
+                /* poll request of the element is done */
+                lte = events[idx].data.ptr;
+                pthread_mutex_lock(&lte->mutex);
+                lte->armed = 0;
+                lte->cancelling = false;
+                pthread_mutex_unlock(&lte->mutex);
+            }
+
+        /* poll requests of elements may be lost, these are not waited for */
+        overflow = __atomic_load_n(ring->cq.overflow, __ATOMIC_ACQUIRE);
+        if (overflow != ring->overflow) {
+            ring->overflow = overflow;
+            __atomic_store_n(&ring->rearm_all, true, __ATOMIC_RELEASE);
+        }
+
+        pthread_mutex_unlock(&ring->cq_mutex);
+    }
+
+    return ring->requests == NULL;
+}
+
+static
+void uring_backend_deinit(io_service_t *iosvc) {
+    uring_t *ring = iosvc->backend_data;
+    bool drained = uring_drain(iosvc, ring);
+
+    uring_unmap(ring);
+    close(ring->fd);
+
+    /* requests left are leaked along with the pool, kernel may still
+     * write to these
+     */
+    if (drained) uring_fixed_deinit(ring);
+
+    pthread_mutex_destroy(&ring->sq_mutex);
+    pthread_mutex_destroy(&ring->cq_mutex);
+
+    deallocate(ring);
+    iosvc->backend_data = NULL;
+}
+
+/* Only one poll request per element is outstanding. If events of armed
+ * element change, the request is removed and its completion re-arms
+ * the element.
+ */
+static
+void uring_backend_sync(io_service_t *iosvc, lookup_table_element_t *lte) {
+    uring_t *ring = iosvc->backend_data;
+
+    if (ring->closing) {
+        /* poll request may be lost, it is not waited for */
+        if (__atomic_load_n(&ring->rearm_all, __ATOMIC_ACQUIRE))
+            lte->armed = 0;
+
+        if (!lte->armed) return;
+
+        pthread_mutex_lock(&ring->sq_mutex);
+
+        ++ring->armed;
+
+        /* removal which did not fit the ring is retried on next sync */
+        if (!lte->cancelling)
+            lte->cancelling = uring_poll_remove(ring, (uintptr_t)lte);
+
+        pthread_mutex_unlock(&ring->sq_mutex);
+
+        return;
+    }
+
+    /* poll request of the element may be lost, arm another one */
+    if (__atomic_load_n(&ring->rearm_all, __ATOMIC_ACQUIRE)) {
+        lte->armed = 0;
+        lte->cancelling = false;
+    }
+
+    if (lte->armed) {
+        if (lte->armed == lte->events || lte->cancelling) {
+            atomic_fetch_add_explicit(&iosvc->stats.ctl_skipped, 1,
+                                      memory_order_relaxed);
+            return;
+        }
+
+        atomic_fetch_add_explicit(&iosvc->stats.ctl_calls, 1,
+                                  memory_order_relaxed);
+
+        pthread_mutex_lock(&ring->sq_mutex);
+        lte->cancelling = uring_poll_remove(ring, (uintptr_t)lte);
+        uring_kick(ring);
+        pthread_mutex_unlock(&ring->sq_mutex);
+
+        /* retry once the ring is consumed */
+        if (!lte->cancelling) iosvc_lookup_table_queue(iosvc, lte);
+
+        return;
+    }
+
+    if (lte->events == 0) {
+        iosvc_lookup_table_release(iosvc, lte);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&iosvc->stats.ctl_calls, 1,
+                              memory_order_relaxed);
+
+    pthread_mutex_lock(&ring->sq_mutex);
+
+    if (uring_poll_add(ring, lte->fd, lte->events, (uintptr_t)lte)) {
+        lte->armed = lte->events;
+        lte->cancelling = false;
+    }
+
+    uring_kick(ring);
+    pthread_mutex_unlock(&ring->sq_mutex);
+
+    /* retry once the ring is consumed */
+    if (!lte->armed) iosvc_lookup_table_queue(iosvc, lte);
+}
+
+static
+void uring_backend_notified(io_service_t *iosvc) {
+    /* changes are applied immediately with sync unless the submission
+     * ring was full
+     */
+    iosvc_lookup_table_sync_queued(iosvc);
+}
+
+static
+void uring_backend_rearm_notification(io_service_t *iosvc) {
+    uring_t *ring = iosvc->backend_data;
+
+    pthread_mutex_lock(&ring->sq_mutex);
+
+    if (!ring->notification_armed) {
+        ring->notification_armed =
+            uring_poll_add(ring, iosvc->event_fd, POLLIN,
+                           URING_NOTIFICATION_TAG);
+        uring_kick(ring);
+    }
+
+    pthread_mutex_unlock(&ring->sq_mutex);
+}
+
+/* translate completions to events. Called with cq_mutex locked. */
+static
+size_t uring_reap(uring_t *ring, struct epoll_event *events, size_t max_events) {
+    unsigned head = *ring->cq.head;
+    unsigned tail = __atomic_load_n(ring->cq.tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe;
+    iosvc_request_t *req;
+    size_t count = 0;
+
+    for (; head != tail && count < max_events; ++head) {
+        cqe = ring->cq.cqes + (head & *ring->cq.mask);
+
+        if (cqe->user_data == URING_IGNORE_TAG) continue;
+
+        if (cqe->user_data & IOSVC_REQUEST_TAG &&
+            cqe->user_data != URING_NOTIFICATION_TAG) {
+            req = (iosvc_request_t *)(uintptr_t)(cqe->user_data &
+                                                 ~IOSVC_REQUEST_TAG);
+            req->res = cqe->res;
+
+            pthread_mutex_lock(&ring->sq_mutex);
+
+            uring_request_unlink(ring, req);
+
+            if (req->slot >= 0) {
+                if (req->res > 0)
+                    memcpy(req->data, uring_fixed_buffer(ring, req->slot),
+                           req->res);
+
+                ring->fixed.vacant[ring->fixed.vacant_count++] = req->slot;
+                req->slot = -1;
+            }
+
+            pthread_mutex_unlock(&ring->sq_mutex);
+
+            events[count].data.u64 = cqe->user_data;
+            events[count].events = 0;
+            ++count;
+            continue;
+        }
+
+        if (cqe->user_data == URING_NOTIFICATION_TAG) {
+            pthread_mutex_lock(&ring->sq_mutex);
+            ring->notification_armed = false;
+            pthread_mutex_unlock(&ring->sq_mutex);
+
+            events[count].data.ptr = NULL;
+            events[count].events = EPOLLIN;
+            ++count;
+            continue;
+        }
+
+        events[count].data.ptr = (void *)(uintptr_t)cqe->user_data;
+
+        if (cqe->res >= 0)
+            events[count].events = (uint32_t)cqe->res;
+        else if (cqe->res == -ECANCELED || cqe->res == -ENOENT)
+            events[count].events = 0;
+        else
+            events[count].events = EPOLLERR;
+
+        ++count;
+    }
+
+    __atomic_store_n(ring->cq.head, head, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+static
+int uring_backend_wait(io_service_t *iosvc,
+                       struct epoll_event *events, size_t max_events,
+                       int timeout) {
+    uring_t *ring = iosvc->backend_data;
+    size_t count;
+    unsigned to_submit, overflow;
+    bool wait, flush, rearm_all = false;
+    int r;
+
+    pthread_mutex_lock(&ring->cq_mutex);
+
+    count = uring_reap(ring, events, max_events);
+    wait = count == 0 && timeout != 0;
+
+    /* completions which did not fit the ring are kept by kernel until
+     * fetched with enter
+     */
+    flush = __atomic_load_n(ring->sq.flags, __ATOMIC_ACQUIRE) &
+            IORING_SQ_CQ_OVERFLOW;
+
+    pthread_mutex_lock(&ring->sq_mutex);
+    to_submit = uring_pending(ring);
+    ring->waiting = wait;
+    pthread_mutex_unlock(&ring->sq_mutex);
+
+    /* submit requests queued with dispatch of previous batch
+     * and wait for completions if there are none
+     */
+    if (wait || to_submit || flush) {
+        r = uring_enter(ring->fd, to_submit,
+                        wait ? 1 : 0,
+                        wait || flush ? IORING_ENTER_GETEVENTS : 0);
+
+        if (wait) {
+            pthread_mutex_lock(&ring->sq_mutex);
+            ring->waiting = false;
+            pthread_mutex_unlock(&ring->sq_mutex);
+        }
+
+        if (r >= 0 || errno == EINTR)
+            count += uring_reap(ring, events + count, max_events - count);
+    }
+
+    /* completions are dropped if kernel could not keep them, poll
+     * requests of some elements are lost then
+     */
+    overflow = __atomic_load_n(ring->cq.overflow, __ATOMIC_ACQUIRE);
+    if (overflow != ring->overflow) {
+        ring->overflow = overflow;
+        rearm_all = true;
+    }
+
+    pthread_mutex_unlock(&ring->cq_mutex);
+
+    /* Arm every element anew. Elements which requests are not lost get
+     * extra ones and may see spurious readiness.
+     */
+    if (rearm_all) {
+        __atomic_store_n(&ring->rearm_all, true, __ATOMIC_RELEASE);
+        iosvc_lookup_table_sync_all(iosvc);
+        __atomic_store_n(&ring->rearm_all, false, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&ring->sq_mutex);
+        ring->notification_armed = false;
+        pthread_mutex_unlock(&ring->sq_mutex);
+    }
+
+    /* notification could not be armed if submission ring was full */
+    if (!__atomic_load_n(&ring->notification_armed, __ATOMIC_ACQUIRE))
+        uring_backend_rearm_notification(iosvc);
+
+    return (int)count;
+}
+
+static
+bool uring_backend_submit(io_service_t *iosvc, iosvc_request_t *req) {
+    uring_t *ring = iosvc->backend_data;
+    struct io_uring_sqe *sqe;
+
+    pthread_mutex_lock(&ring->sq_mutex);
+
+    if (req->data) {
+        if (!ring->fixed.vacant_count) {
+            pthread_mutex_unlock(&ring->sq_mutex);
+            return false;
+        }
+
+        req->slot = ring->fixed.vacant[--ring->fixed.vacant_count];
+    }
+
+    sqe = uring_get_sqe(ring);
+
+    if (!sqe) {
+        if (req->slot >= 0)
+            ring->fixed.vacant[ring->fixed.vacant_count++] = req->slot;
+
+        pthread_mutex_unlock(&ring->sq_mutex);
+        return false;
+    }
+
+    sqe->fd = req->fd;
+
+    if (req->slot >= 0) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uintptr_t)uring_fixed_buffer(ring, req->slot);
+        sqe->len = req->len;
+        sqe->buf_index = 0;
+    }
+    else {
+        sqe->opcode = req->op == IO_SVC_OP_READ
+                       ? IORING_OP_RECVMSG
+                       : IORING_OP_SENDMSG;
+        sqe->addr = (uintptr_t)req->msg;
+        sqe->len = 1;
+        sqe->msg_flags = req->flags;
+    }
+
+    sqe->user_data = (uintptr_t)req | IOSVC_REQUEST_TAG;
+
+    uring_commit_sqe(ring);
+    uring_request_link(ring, req);
+    uring_kick(ring);
+
+    pthread_mutex_unlock(&ring->sq_mutex);
+
+    return true;
+}
+
+const io_service_backend_ops_t IO_SVC_URING_OPS = {
+    .init = uring_backend_init,
+    .deinit = uring_backend_deinit,
+    .sync = uring_backend_sync,
+    .update = uring_backend_sync,
+    .notified = uring_backend_notified,
+    .rearm_notification = uring_backend_rearm_notification,
+    .wait = uring_backend_wait,
+    .submit = uring_backend_submit,
+    /* re-arming poll request costs no syscall here */
+    .edge_triggered = false
+};
+
+#endif /* IO_SERVICE_WITH_URING */
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+
+#include "io-service-group.h"
+#include "memory.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+
+typedef struct io_service_group_member {
+    io_service_t *iosvc;
+    /* CPU the service thread is pinned to, -1 if not pinned */
+    int cpu;
+    pthread_t thread;
+} io_service_group_member_t;
+
+struct io_service_group {
+    size_t count;
+    io_service_group_member_t *member;
+    atomic_size_t next;
+};
+
+/* fetch CPUs available to the process in ascending order */
+static
+size_t available_cpus(int *cpus, size_t max) {
+    cpu_set_t set;
+    size_t count = 0;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(set), &set)) return 0;
+
+    for (cpu = 0; cpu < CPU_SETSIZE && (!cpus || count < max); ++cpu) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+
+        if (cpus) cpus[count] = cpu;
+        ++count;
+    }
+
+    return count;
+}
+
+static
+void *member_thread(void *ctx) {
+    io_service_group_member_t *member = ctx;
+    cpu_set_t set;
+
+    if (member->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(member->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    io_service_run(member->iosvc);
+
+    return NULL;
+}
+
+io_service_group_t *io_service_group_init(size_t count,
+                                          const io_service_params_t *params) {
+    io_service_group_t *grp;
+    int *cpus;
+    size_t cpus_count;
+    size_t idx;
+    int r;
+
+    cpus_count = available_cpus(NULL, 0);
+
+    if (!count) count = cpus_count ? cpus_count : 1;
+
+    cpus = allocate((cpus_count ? cpus_count : 1) * sizeof(int));
+    if (!cpus) return NULL;
+
+    cpus_count = available_cpus(cpus, cpus_count);
+
+    grp = allocate(sizeof(io_service_group_t));
+    if (!grp) {
+        deallocate(cpus);
+        return NULL;
+    }
+
+    grp->count = count;
+    grp->member = allocate(count * sizeof(io_service_group_member_t));
+    atomic_init(&grp->next, 0);
+
+    if (!grp->member) {
+        deallocate(grp);
+        deallocate(cpus);
+        return NULL;
+    }
+
+    memset(grp->member, 0, count * sizeof(io_service_group_member_t));
+
+    for (idx = 0; idx < count; ++idx) {
+        grp->member[idx].cpu = cpus_count ? cpus[idx % cpus_count] : -1;
+        grp->member[idx].iosvc = io_service_init_params(params);
+
+        if (!grp->member[idx].iosvc) break;
+    }
+
+    deallocate(cpus);
+
+    if (idx < count) {
+        r = errno;
+
+        while (idx--) io_service_deinit(grp->member[idx].iosvc);
+
+        deallocate(grp->member);
+        deallocate(grp);
+        errno = r;
+        return NULL;
+    }
+
+    return grp;
+}
+
+void io_service_group_deinit(io_service_group_t *grp) {
+    size_t idx;
+
+    if (!grp) return;
+
+    for (idx = 0; idx < grp->count; ++idx)
+        io_service_deinit(grp->member[idx].iosvc);
+
+    deallocate(grp->member);
+    deallocate(grp);
+}
+
+size_t io_service_group_size(io_service_group_t *grp) {
+    return grp ? grp->count : 0;
+}
+
+io_service_t *io_service_group_at(io_service_group_t *grp, size_t idx) {
+    if (!grp || idx >= grp->count) return NULL;
+
+    return grp->member[idx].iosvc;
+}
+
+int io_service_group_cpu(io_service_group_t *grp, size_t idx) {
+    if (!grp || idx >= grp->count) return -1;
+
+    return grp->member[idx].cpu;
+}
+
+io_service_t *io_service_group_by_fd(io_service_group_t *grp, int fd) {
+    if (!grp || fd < 0) return NULL;
+
+    return grp->member[(size_t)fd % grp->count].iosvc;
+}
+
+io_service_t *io_service_group_next(io_service_group_t *grp) {
+    size_t idx;
+
+    if (!grp) return NULL;
+
+    idx = atomic_fetch_add_explicit(&grp->next, 1, memory_order_relaxed);
+
+    return grp->member[idx % grp->count].iosvc;
+}
+
+bool io_service_group_run(io_service_group_t *grp) {
+    size_t idx, started;
+    int r = 0;
+
+    if (!grp) return false;
+
+    for (started = 0; started < grp->count; ++started) {
+        r = pthread_create(&grp->member[started].thread, NULL,
+                           member_thread, grp->member + started);
+        if (r) break;
+    }
+
+    /* the rest could not run at all, thus the whole group is stopped */
+    if (r)
+        for (idx = 0; idx < started; ++idx)
+            io_service_stop(grp->member[idx].iosvc, false);
+
+    for (idx = 0; idx < started; ++idx)
+        pthread_join(grp->member[idx].thread, NULL);
+
+    if (r) errno = r;
+
+    return !r;
+}
+
+void io_service_group_stop(io_service_group_t *grp, bool wait_pending) {
+    size_t idx;
+
+    if (!grp) return;
+
+    for (idx = 0; idx < grp->count; ++idx)
+        io_service_stop(grp->member[idx].iosvc, wait_pending);
+}
@@ -0,0 +1,47 @@
+#ifndef _IO_SERVICE_GROUP_H_
+# define _IO_SERVICE_GROUP_H_
+
+# include "io-service.h"
+
+# include <stddef.h>
+# include <stdbool.h>
+
+/** Group of IO services, one per CPU
+ * Each service runs in its own thread pinned to its CPU. Users pick a
+ * service for an fd once and keep it for the lifetime of the fd, so that
+ * services share nothing.
+ */
+struct io_service_group;
+typedef struct io_service_group io_service_group_t;
+
+/** IO service group c-tor
+ * \param [in] count count of services, CPUs available to the process
+ *             are counted if \c 0
+ * \param [in] params parameters of every service, defaults for \c NULL
+ * \return \c NULL with errno set on failure
+ */
+io_service_group_t *io_service_group_init(size_t count,
+                                          const io_service_params_t *params);
+void io_service_group_deinit(io_service_group_t *grp);
+size_t io_service_group_size(io_service_group_t *grp);
+io_service_t *io_service_group_at(io_service_group_t *grp, size_t idx);
+/** CPU the service at \c idx is run on, \c -1 if it is not pinned
+ * Pool workers pinned to this CPU share cache with the service.
+ */
+int io_service_group_cpu(io_service_group_t *grp, size_t idx);
+/** Pick service for fd
+ * Returns the same service for the same fd.
+ */
+io_service_t *io_service_group_by_fd(io_service_group_t *grp, int fd);
+/** Pick services round-robin
+ */
+io_service_t *io_service_group_next(io_service_group_t *grp);
+/** Run every service in its own thread pinned to CPU
+ * Returns after every service is stopped.
+ * \return \c false with errno set if some thread could not be started,
+ *         services already started are stopped then
+ */
+bool io_service_group_run(io_service_group_t *grp);
+void io_service_group_stop(io_service_group_t *grp, bool wait_pending);
+
+#endif /* _IO_SERVICE_GROUP_H_ */
@@ -0,0 +1,226 @@
+#ifndef _IO_SERVICE_INTERNAL_H_
+# define _IO_SERVICE_INTERNAL_H_
+
+# include "io-service.h"
+
+# include <stdbool.h>
+# include <stdint.h>
+# include <stdatomic.h>
+# include <pthread.h>
+# include <sys/epoll.h>
+
+/* IO service internals shared between generic part and backends.
+ * Events are passed around as struct epoll_event with data.ptr pointing
+ * to lookup table element or NULL for notification. Event masks are
+ * poll(2) ones, which are equal to EPOLL* ones.
+ */
+
+typedef struct job {
+    iosvc_job_function_t job;
+    void *ctx;
+    bool oneshot;
+    /* persistent edge triggered job */
+    bool edge;
+    /* post time for dispatch lag, 0 once dispatched */
+    uint64_t posted;
+} job_t;
+
+/* Every field except for fd is guarded by mutex */
+typedef struct lookup_table_element {
+    pthread_mutex_t mutex;
+    int fd;
+    /* element is in use, i.e. some job were posted for the fd */
+    bool used;
+    /* fd is added to epoll set */
+    bool in_epoll;
+    /* some runner dispatches jobs of the fd now.
+     * The fd is not armed while the flag is set.
+     */
+    bool busy;
+    /* runner which dispatches jobs while busy */
+    pthread_t dispatcher;
+    /* signalled once the element is not busy, removal waits on it */
+    pthread_cond_t idle;
+    /* removal of armed registration is requested (io_uring) */
+    bool cancelling;
+    /* events the jobs wait for */
+    uint32_t events;
+    /* some job is edge triggered one, registration is persistent then */
+    bool edge;
+    /* events armed in kernel along with EPOLLET for edge triggered
+     * registration, oneshot registrations are disarmed on delivery
+     */
+    uint32_t armed;
+    /* edge triggered events delivered while the element was busy */
+    uint32_t pending;
+    /* element is in the queue of elements to sync */
+    bool queued;
+    /* next element in the queue, owned by the queue */
+    struct lookup_table_element *queue_next;
+    /* time mutex was locked at by dispatch or post, written by holder */
+    uint64_t locked;
+    job_t job[IO_SVC_OP_COUNT];
+} lookup_table_element_t;
+
+/* submitted operation.
+ * Its event has data.ptr tagged with IOSVC_REQUEST_TAG
+ */
+typedef struct iosvc_request {
+    int fd;
+    io_svc_op_t op;
+    int res;
+    iosvc_completion_function_t cb;
+    void *ctx;
+    /* fixed buffer read */
+    int slot;
+    void *data;
+    size_t len;
+    /* msghdr operation */
+    struct msghdr *msg;
+    int flags;
+    /* cancellation is queued (io_uring) */
+    bool cancelling;
+    /* list of requests in kernel, owned by backend */
+    struct iosvc_request *prev;
+    struct iosvc_request *next;
+} iosvc_request_t;
+
+# define IOSVC_REQUEST_TAG      ((uintptr_t)0x01)
+
+typedef struct iosvc_task {
+    iosvc_task_function_t fn;
+    void *ctx;
+    struct iosvc_task *next;
+} iosvc_task_t;
+
+/* slot is claimed by storing job function pointer */
+typedef struct iosvc_job_stats {
+    _Atomic uintptr_t job;
+    atomic_ullong calls;
+    atomic_ullong nsec;
+    atomic_ullong max_nsec;
+} iosvc_job_stats_t;
+
+typedef struct io_service_backend_ops {
+    bool (*init)(io_service_t *iosvc);
+    void (*deinit)(io_service_t *iosvc);
+    /* arm element for its events or drop it if there are none.
+     * Nothing is issued to the kernel if armed events match.
+     * Called with element mutex locked and element not busy.
+     */
+    void (*sync)(io_service_t *iosvc, lookup_table_element_t *lte);
+    /* jobs of idle element were changed while service is running.
+     * Called with element mutex locked.
+     */
+    void (*update)(io_service_t *iosvc, lookup_table_element_t *lte);
+    /* notification was received by the runner */
+    void (*notified)(io_service_t *iosvc);
+    void (*rearm_notification)(io_service_t *iosvc);
+    /* wait for events, returns count of events fetched.
+     * Timeout is either 0 to poll or -1 to block.
+     */
+    int (*wait)(io_service_t *iosvc,
+                struct epoll_event *events, size_t max_events,
+                int timeout);
+    /* submit operation, NULL if not supported */
+    bool (*submit)(io_service_t *iosvc, iosvc_request_t *req);
+    /* edge triggered registrations are supported */
+    bool edge_triggered;
+} io_service_backend_ops_t;
+
+struct io_service {
+    /* are we still running flag */
+    atomic_bool allow_new;
+    atomic_bool running;
+    /* count of threads in io_service_run */
+    size_t runners;
+    /* used for notification purposes */
+    int event_fd;
+    /* job list by fd lookup table  */
+    lookup_table_element_t *_Atomic *lookup_table;
+    size_t lookup_table_pages;
+    /* count of used elements */
+    atomic_size_t lookup_table_count;
+    /* lock-free stack of elements to sync by a runner */
+    lookup_table_element_t *_Atomic sync_queue;
+    /* count of submitted operations not completed yet */
+    atomic_size_t requests_count;
+
+    /* lock-free stack of posted tasks */
+    iosvc_task_t *_Atomic tasks_posted;
+    /* tasks taken from the stack in order of posting.
+     * Guarded by tasks_mutex.
+     */
+    iosvc_task_t *tasks_head;
+    /* count of posted tasks not executed yet */
+    atomic_size_t tasks_count;
+    size_t max_tasks;
+    /* serializes runners taking tasks */
+    pthread_mutex_t tasks_mutex;
+
+    io_svc_backend_t backend;
+    const io_service_backend_ops_t *ops;
+    void *backend_data;
+
+    int epoll_fd;
+    struct epoll_event event_fd_event;
+    /* count of events harvested per wait */
+    size_t max_events;
+    size_t fixed_buffers;
+    size_t fixed_buffer_size;
+    /* spin before blocking, disabled if both are zero */
+    unsigned long spin_usec;
+    size_t spin_polls;
+    unsigned busy_poll_usec;
+    bool timing;
+    io_svc_clock_t clock;
+    /* cached time of the clock, refreshed by runners on wakeup */
+    atomic_ullong now;
+
+    struct {
+        atomic_ullong wakeups;
+        atomic_ullong events;
+        atomic_ullong full_wakeups;
+        atomic_size_t max_events_per_wakeup;
+        /* registration changes issued to and skipped for the kernel */
+        atomic_ullong ctl_calls;
+        atomic_ullong ctl_skipped;
+        atomic_ullong tasks;
+        atomic_ullong spin_wakeups;
+        atomic_ullong blocks;
+        atomic_ullong spin_nsec;
+        atomic_ullong block_nsec;
+        atomic_histogram_t events_per_wakeup;
+        atomic_histogram_t callback_nsec;
+        atomic_histogram_t dispatch_lag_nsec;
+        atomic_histogram_t element_mutex_nsec;
+        iosvc_job_stats_t job[IO_SERVICE_JOB_STATS_SLOTS];
+    } stats;
+
+    /* objects of other modules, set once under object mutex */
+    void *_Atomic attachment[IO_SVC_ATTACHMENT_COUNT];
+    iosvc_attachment_dtor_t attachment_dtor[IO_SVC_ATTACHMENT_COUNT];
+
+    /* guards page allocation and runners count */
+    pthread_mutex_t object_mutex;
+};
+
+extern const io_service_backend_ops_t IO_SVC_EPOLL_OPS;
+# ifdef IO_SERVICE_WITH_URING
+extern const io_service_backend_ops_t IO_SVC_URING_OPS;
+# endif
+
+/* mark element unused. Called with element mutex locked. */
+void iosvc_lookup_table_release(io_service_t *iosvc,
+                                lookup_table_element_t *lte);
+/* queue element to be synced by a runner.
+ * Called with element mutex locked.
+ */
+void iosvc_lookup_table_queue(io_service_t *iosvc,
+                              lookup_table_element_t *lte);
+/* sync queued elements */
+void iosvc_lookup_table_sync_queued(io_service_t *iosvc);
+/* sync every used element which is not being dispatched now */
+void iosvc_lookup_table_sync_all(io_service_t *iosvc);
+
+#endif /* _IO_SERVICE_INTERNAL_H_ */
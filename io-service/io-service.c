@@ -1,43 +1,37 @@
 #include "io-service.h"
+#include "io-service-internal.h"
 #include "common.h"
 
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <assert.h>
 
 #include <sys/eventfd.h>
-#include <sys/epoll.h>
 
-typedef struct job {
-    iosvc_job_function_t job;
-    void *ctx;
-    bool oneshot;
-} job_t;
-
-typedef struct lookup_table_element {
-    int fd;
-    struct epoll_event event;
-    job_t job[IO_SVC_OP_COUNT];
-} lookup_table_element_t;
-
-struct io_service {
-    /* are we still running flag */
-    bool allow_new;
-    bool running;
-    /* used for notification purposes */
-    int event_fd;
-    /* job list by fd lookup table  */
-    list_t *lookup_table;
-
-    int epoll_fd;
-    struct epoll_event event_fd_event;
-
-    pthread_mutex_t object_mutex;
+/* lookup table is a two-level table indexed by fd.
+ * Page directory is allocated once for the fd limit of the process.
+ * Pages are allocated on demand and never moved so that element pointers
+ * are stable and may be passed to kernel as event user data.
+ */
+#define LOOKUP_TABLE_PAGE_SHIFT    10
+#define LOOKUP_TABLE_PAGE_SIZE     (1 << LOOKUP_TABLE_PAGE_SHIFT)
+#define LOOKUP_TABLE_PAGE_MASK     (LOOKUP_TABLE_PAGE_SIZE - 1)
+#define LOOKUP_TABLE_MAX_FD        (1 << 24)
+
+static const io_service_backend_ops_t *BACKENDS[IO_SVC_BACKEND_COUNT] = {
+    [IO_SVC_BACKEND_EPOLL] = &IO_SVC_EPOLL_OPS,
+#ifdef IO_SERVICE_WITH_URING
+    [IO_SVC_BACKEND_URING] = &IO_SVC_URING_OPS,
+#endif
 };
 
 static const int OP_FLAGS[IO_SVC_OP_COUNT] = {
@@ -50,227 +44,993 @@ void notify_svc(int fd) {
     eventfd_write(fd, 1);
 }
 
+static const clockid_t CLOCKS[IO_SVC_CLOCK_COUNT] = {
+    [IO_SVC_CLOCK_MONOTONIC] = CLOCK_MONOTONIC,
+    [IO_SVC_CLOCK_MONOTONIC_COARSE] = CLOCK_MONOTONIC_COARSE
+};
+
 static
 eventfd_t svc_notified(int fd) {
-    eventfd_t v;
+    eventfd_t v = 0;
     eventfd_read(fd, &v);
     return v;
 }
 
+/* service run by the current thread, if any */
+static _Thread_local io_service_t *current_service = NULL;
+
+/* refresh cached time, runners may race so it is only moved forward */
+static
+uint64_t update_now(io_service_t *iosvc) {
+    struct timespec ts;
+    unsigned long long now, cached;
+
+    clock_gettime(CLOCKS[iosvc->clock], &ts);
+    now = (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    cached = atomic_load_explicit(&iosvc->now, memory_order_relaxed);
+    while (now > cached &&
+           !atomic_compare_exchange_weak_explicit(
+                &iosvc->now, &cached, now,
+                memory_order_relaxed, memory_order_relaxed));
+
+    return now > cached ? now : cached;
+}
+
+/* account execution time of job function.
+ * Functions are kept in open addressing table, which is never cleaned up.
+ * Functions which do not fit are not accounted.
+ */
+static
+void job_stats_add(io_service_t *iosvc, iosvc_job_function_t job,
+                   uint64_t nsec) {
+    uintptr_t key = (uintptr_t)job;
+    uintptr_t cur;
+    iosvc_job_stats_t *slot;
+    size_t probe, idx = (key >> 4) % IO_SERVICE_JOB_STATS_SLOTS;
+
+    for (probe = 0; probe < IO_SERVICE_JOB_STATS_SLOTS; ++probe) {
+        slot = iosvc->stats.job + (idx + probe) % IO_SERVICE_JOB_STATS_SLOTS;
+        cur = atomic_load_explicit(&slot->job, memory_order_relaxed);
+
+        /* claim vacant slot, cur is set to the winner on failure */
+        if (!cur &&
+            atomic_compare_exchange_strong_explicit(&slot->job, &cur, key,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed))
+            cur = key;
+
+        if (cur != key) continue;
+
+        atomic_fetch_add_explicit(&slot->calls, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&slot->nsec, nsec, memory_order_relaxed);
+        atomic_max(&slot->max_nsec, nsec);
+        return;
+    }
+}
+
+static
+void object_lock(io_service_t *iosvc) {
+    pthread_mutex_lock(&iosvc->object_mutex);
+}
+
+static
+void object_unlock(io_service_t *iosvc) {
+    pthread_mutex_unlock(&iosvc->object_mutex);
+}
+
+/* element mutex is the one contended by runners and posters */
+static
+void element_lock(io_service_t *iosvc, lookup_table_element_t *lte) {
+    pthread_mutex_lock(&lte->mutex);
+
+    if (iosvc->timing) lte->locked = now_nsec();
+}
+
+static
+void element_unlock(io_service_t *iosvc, lookup_table_element_t *lte) {
+    if (iosvc->timing)
+        histogram_add(&iosvc->stats.element_mutex_nsec,
+                      now_nsec() - lte->locked);
+
+    pthread_mutex_unlock(&lte->mutex);
+}
+
+static
+size_t lookup_table_pages_count(void) {
+    struct rlimit rlim;
+    rlim_t max_fd = LOOKUP_TABLE_MAX_FD;
+
+    if (!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_max < max_fd)
+        max_fd = rlim.rlim_max;
+
+    return (max_fd + LOOKUP_TABLE_PAGE_SIZE - 1) >> LOOKUP_TABLE_PAGE_SHIFT;
+}
+
+/* fetch lookup table element for fd, allocating its page if required
+ * and allowed with \c create.
+ */
+static
+lookup_table_element_t *lookup_table_get(io_service_t *iosvc, int fd,
+                                         bool create) {
+    size_t page_idx = (size_t)fd >> LOOKUP_TABLE_PAGE_SHIFT;
+    lookup_table_element_t *page;
+    size_t idx;
+
+    if (page_idx >= iosvc->lookup_table_pages) return NULL;
+
+    page = atomic_load_explicit(iosvc->lookup_table + page_idx,
+                                memory_order_acquire);
+
+    if (page) return page + (fd & LOOKUP_TABLE_PAGE_MASK);
+    if (!create) return NULL;
+
+    object_lock(iosvc);
+
+    page = atomic_load_explicit(iosvc->lookup_table + page_idx,
+                                memory_order_relaxed);
+
+    if (!page) {
+        page = allocate(LOOKUP_TABLE_PAGE_SIZE * sizeof(*page));
+
+        if (page) {
+            memset(page, 0, LOOKUP_TABLE_PAGE_SIZE * sizeof(*page));
+            for (idx = 0; idx < LOOKUP_TABLE_PAGE_SIZE; ++idx) {
+                pthread_mutex_init(&page[idx].mutex, NULL);
+                pthread_cond_init(&page[idx].idle, NULL);
+                page[idx].fd = (int)((page_idx << LOOKUP_TABLE_PAGE_SHIFT) | idx);
+            }
+
+            atomic_store_explicit(iosvc->lookup_table + page_idx, page,
+                                  memory_order_release);
+        }
+    }
+
+    object_unlock(iosvc);
+
+    return page ? page + (fd & LOOKUP_TABLE_PAGE_MASK) : NULL;
+}
+
+void iosvc_lookup_table_release(io_service_t *iosvc,
+                                lookup_table_element_t *lte) {
+    lte->in_epoll = false;
+    lte->used = false;
+    lte->events = 0;
+    lte->edge = false;
+    lte->armed = 0;
+    lte->pending = 0;
+    memset(lte->job, 0, sizeof(lte->job));
+
+    /* let runners check if they should stop */
+    if (atomic_fetch_sub(&iosvc->lookup_table_count, 1) == 1 &&
+        !atomic_load(&iosvc->allow_new))
+        notify_svc(iosvc->event_fd);
+}
+
+/* registration is edge triggered while some job is. Called with element
+ * mutex locked.
+ */
+static
+void lookup_table_update_mode(lookup_table_element_t *lte) {
+    io_svc_op_t op;
+
+    lte->edge = false;
+
+    for (op = 0; op < IO_SVC_OP_COUNT; ++op)
+        if (lte->job[op].job && lte->job[op].edge) lte->edge = true;
+}
+
+void iosvc_lookup_table_sync_all(io_service_t *iosvc) {
+    size_t page_idx, idx;
+    lookup_table_element_t *page, *lte;
+
+    for (page_idx = 0; page_idx < iosvc->lookup_table_pages; ++page_idx) {
+        page = atomic_load_explicit(iosvc->lookup_table + page_idx,
+                                    memory_order_acquire);
+        if (!page) continue;
+
+        for (idx = 0; idx < LOOKUP_TABLE_PAGE_SIZE; ++idx) {
+            lte = page + idx;
+
+            pthread_mutex_lock(&lte->mutex);
+            if (lte->used && !lte->busy) iosvc->ops->sync(iosvc, lte);
+            pthread_mutex_unlock(&lte->mutex);
+        }
+    }
+}
+
+/* Producers push elements with CAS and only the one which finds the
+ * queue empty notifies runners, so that a burst of posts costs single
+ * wakeup. Runner takes the whole queue at once.
+ */
+void iosvc_lookup_table_queue(io_service_t *iosvc,
+                              lookup_table_element_t *lte) {
+    lookup_table_element_t *head;
+
+    if (lte->queued) return;
+
+    lte->queued = true;
+
+    head = atomic_load_explicit(&iosvc->sync_queue, memory_order_relaxed);
+
+    do {
+        lte->queue_next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&iosvc->sync_queue,
+                                                    &head, lte,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+
+    if (!head) notify_svc(iosvc->event_fd);
+}
+
+void iosvc_lookup_table_sync_queued(io_service_t *iosvc) {
+    lookup_table_element_t *lte, *next;
+
+    lte = atomic_exchange_explicit(&iosvc->sync_queue, NULL,
+                                   memory_order_acquire);
+
+    for (; lte; lte = next) {
+        /* the element may be queued again once the flag is reset */
+        next = lte->queue_next;
+
+        pthread_mutex_lock(&lte->mutex);
+        lte->queued = false;
+        if (lte->used && !lte->busy) iosvc->ops->sync(iosvc, lte);
+        pthread_mutex_unlock(&lte->mutex);
+    }
+}
+
+static
+void lookup_table_deinit(io_service_t *iosvc) {
+    size_t page_idx, idx;
+    lookup_table_element_t *page;
+
+    for (page_idx = 0; page_idx < iosvc->lookup_table_pages; ++page_idx) {
+        page = atomic_load(iosvc->lookup_table + page_idx);
+        if (!page) continue;
+
+        for (idx = 0; idx < LOOKUP_TABLE_PAGE_SIZE; ++idx) {
+            pthread_cond_destroy(&page[idx].idle);
+            pthread_mutex_destroy(&page[idx].mutex);
+        }
+
+        deallocate(page);
+    }
+
+    deallocate(iosvc->lookup_table);
+    iosvc->lookup_table = NULL;
+    iosvc->lookup_table_pages = 0;
+}
+
+/* dispatch jobs of the element for the events.
+ * Only one runner dispatches the element at a time. Oneshot events
+ * delivered to another runner meanwhile are dropped. Registration is
+ * level-triggered, so these are reported again once the element is
+ * re-armed. Edge triggered events are kept pending for the dispatcher.
+ * Every event delivered disarms the oneshot registration.
+ */
+static
+void dispatch_element(io_service_t *iosvc, lookup_table_element_t *lte,
+                      uint32_t events) {
+    io_svc_op_t op;
+    iosvc_job_function_t job;
+    void *ctx;
+    uint64_t posted, start, elapsed;
+
+    element_lock(iosvc, lte);
+
+    if (!lte->edge) lte->armed = 0;
+
+    if (lte->busy || !lte->used) {
+        if (lte->busy && lte->edge) lte->pending |= events;
+
+        element_unlock(iosvc, lte);
+        return;
+    }
+
+    lte->busy = true;
+    lte->dispatcher = pthread_self();
+
+    do {
+        /* let the jobs find out the error themselves */
+        if (events & (EPOLLERR | EPOLLHUP)) events |= lte->events;
+
+        for (op = 0; op < IO_SVC_OP_COUNT; ++op) {
+            if (!(events & OP_FLAGS[op])) continue;
+            if (lte->job[op].job == NULL) continue;
+
+            job = lte->job[op].job;
+            ctx = lte->job[op].ctx;
+            posted = lte->job[op].posted;
+            lte->job[op].posted = 0;
+
+            if (lte->job[op].oneshot) {
+                lte->job[op].ctx = lte->job[op].job = NULL;
+                lte->events &= ~OP_FLAGS[op];
+            }
+
+            element_unlock(iosvc, lte);
+
+            if (iosvc->timing) {
+                start = io_service_now(iosvc);
+
+                if (posted)
+                    histogram_add(&iosvc->stats.dispatch_lag_nsec,
+                                  start - posted);
+
+                (*job)(lte->fd, op, ctx);
+
+                /* the end of one callback is the start of the next one */
+                elapsed = update_now(iosvc) - start;
+                histogram_add(&iosvc->stats.callback_nsec, elapsed);
+                job_stats_add(iosvc, job, elapsed);
+            }
+            else
+                (*job)(lte->fd, op, ctx);
+
+            element_lock(iosvc, lte);
+        }   /* for (op = 0; op < IO_SVC_OP_COUNT; ++op) */
+
+        events = lte->pending;
+        lte->pending = 0;
+    } while (events);
+
+    lte->busy = false;
+    iosvc->ops->sync(iosvc, lte);
+    pthread_cond_broadcast(&lte->idle);
+
+    element_unlock(iosvc, lte);
+}
+
+static
+void dispatch_request(io_service_t *iosvc, iosvc_request_t *req) {
+    (*req->cb)(req->fd, req->op, req->res, req->ctx);
+
+    deallocate(req);
+
+    /* let runners check if they should stop */
+    if (atomic_fetch_sub(&iosvc->requests_count, 1) == 1 &&
+        !atomic_load(&iosvc->allow_new))
+        notify_svc(iosvc->event_fd);
+}
+
+static
+bool submit_request(io_service_t *iosvc, iosvc_request_t *req) {
+    atomic_fetch_add(&iosvc->requests_count, 1);
+
+    if (iosvc->ops->submit(iosvc, req)) return true;
+
+    atomic_fetch_sub(&iosvc->requests_count, 1);
+    deallocate(req);
+
+    return false;
+}
+
+/* execute at most max_tasks of posted tasks.
+ * Tasks are taken from the lock-free stack all at once and reversed into
+ * the list in order of posting. Runners are notified again if some of
+ * them are left for the next wakeup.
+ */
+static
+void run_tasks(io_service_t *iosvc) {
+    iosvc_task_t *batch, *task, *next;
+    size_t count;
+
+    pthread_mutex_lock(&iosvc->tasks_mutex);
+
+    if (!iosvc->tasks_head) {
+        task = atomic_exchange_explicit(&iosvc->tasks_posted, NULL,
+                                        memory_order_acquire);
+
+        for (; task; task = next) {
+            next = task->next;
+            task->next = iosvc->tasks_head;
+            iosvc->tasks_head = task;
+        }
+    }
+
+    batch = task = iosvc->tasks_head;
+
+    for (count = 1; task && count < iosvc->max_tasks; ++count)
+        task = task->next;
+
+    if (task) {
+        iosvc->tasks_head = task->next;
+        task->next = NULL;
+    }
+    else
+        iosvc->tasks_head = NULL;
+
+    if (iosvc->tasks_head) notify_svc(iosvc->event_fd);
+
+    pthread_mutex_unlock(&iosvc->tasks_mutex);
+
+    for (count = 0; batch; batch = next, ++count) {
+        next = batch->next;
+        (*batch->fn)(batch->ctx);
+        deallocate(batch);
+    }
+
+    if (!count) return;
+
+    atomic_fetch_add_explicit(&iosvc->stats.tasks, count,
+                              memory_order_relaxed);
+    atomic_fetch_sub(&iosvc->tasks_count, count);
+}
+
+static
+void free_tasks(iosvc_task_t *task) {
+    iosvc_task_t *next;
+
+    for (; task; task = next) {
+        next = task->next;
+        deallocate(task);
+    }
+}
+
+/* wait for events, polling first if spinning is enabled.
+ * Time is measured in spinning mode only.
+ */
+static
+int wait_events(io_service_t *iosvc,
+                struct epoll_event *events, size_t max_events) {
+    uint64_t start, now;
+    size_t polls = 0;
+    int r;
+
+    if (!iosvc->spin_usec && !iosvc->spin_polls)
+        return iosvc->ops->wait(iosvc, events, max_events, -1);
+
+    start = now_nsec();
+
+    for (;;) {
+        r = iosvc->ops->wait(iosvc, events, max_events, 0);
+        now = now_nsec();
+
+        if (r > 0) {
+            atomic_fetch_add_explicit(&iosvc->stats.spin_wakeups, 1,
+                                      memory_order_relaxed);
+            atomic_fetch_add_explicit(&iosvc->stats.spin_nsec, now - start,
+                                      memory_order_relaxed);
+            return r;
+        }
+
+        ++polls;
+
+        if (iosvc->spin_polls && polls >= iosvc->spin_polls) break;
+        if (iosvc->spin_usec && now - start >= iosvc->spin_usec * 1000ULL)
+            break;
+    }
+
+    atomic_fetch_add_explicit(&iosvc->stats.spin_nsec, now - start,
+                              memory_order_relaxed);
+
+    r = iosvc->ops->wait(iosvc, events, max_events, -1);
+
+    atomic_fetch_add_explicit(&iosvc->stats.blocks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&iosvc->stats.block_nsec, now_nsec() - now,
+                              memory_order_relaxed);
+
+    return r;
+}
+
+static
+void update_stats(io_service_t *iosvc, size_t events) {
+    size_t max;
+
+    atomic_fetch_add_explicit(&iosvc->stats.wakeups, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&iosvc->stats.events, events, memory_order_relaxed);
+    histogram_add(&iosvc->stats.events_per_wakeup, events);
+
+    if (events == iosvc->max_events)
+        atomic_fetch_add_explicit(&iosvc->stats.full_wakeups, 1,
+                                  memory_order_relaxed);
+
+    max = atomic_load_explicit(&iosvc->stats.max_events_per_wakeup,
+                               memory_order_relaxed);
+    while (events > max &&
+           !atomic_compare_exchange_weak_explicit(
+                &iosvc->stats.max_events_per_wakeup, &max, events,
+                memory_order_relaxed, memory_order_relaxed));
+}
+
 io_service_t *io_service_init() {
+    return io_service_init_params(NULL);
+}
+
+io_service_t *io_service_init_params(const io_service_params_t *params) {
     io_service_t *iosvc = allocate(sizeof(io_service_t));
     int r;
 
     memset(iosvc, 0, sizeof(io_service_t));
 
+    iosvc->max_events = params && params->max_events
+                         ? params->max_events
+                         : IO_SERVICE_DEFAULT_MAX_EVENTS;
+    iosvc->backend = params ? params->backend : IO_SVC_BACKEND_EPOLL;
+    iosvc->fixed_buffers = params && params->fixed_buffers
+                            ? params->fixed_buffers
+                            : IO_SERVICE_DEFAULT_FIXED_BUFFERS;
+    iosvc->fixed_buffer_size = params && params->fixed_buffer_size
+                                ? params->fixed_buffer_size
+                                : IO_SERVICE_DEFAULT_FIXED_BUFFER_SIZE;
+    iosvc->max_tasks = params && params->max_tasks
+                        ? params->max_tasks
+                        : IO_SERVICE_DEFAULT_MAX_TASKS;
+    iosvc->spin_usec = params ? params->spin_usec : 0;
+    iosvc->spin_polls = params ? params->spin_polls : 0;
+    iosvc->busy_poll_usec = params ? params->busy_poll_usec : 0;
+    iosvc->timing = params ? params->timing : false;
+    iosvc->clock = params ? params->clock : IO_SVC_CLOCK_MONOTONIC;
+    iosvc->epoll_fd = -1;
+
+    if (iosvc->backend >= IO_SVC_BACKEND_COUNT || !BACKENDS[iosvc->backend] ||
+        iosvc->clock >= IO_SVC_CLOCK_COUNT) {
+        deallocate(iosvc);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    iosvc->ops = BACKENDS[iosvc->backend];
+
     r = pthread_mutex_init(&iosvc->object_mutex, NULL);
 
     if (r) {
+        deallocate(iosvc);
         errno = r;
         return NULL;
     }
 
-    iosvc->event_fd = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
+    r = pthread_mutex_init(&iosvc->tasks_mutex, NULL);
 
-    if (iosvc->event_fd < 0) {
+    if (r) {
         pthread_mutex_destroy(&iosvc->object_mutex);
         deallocate(iosvc);
+        errno = r;
         return NULL;
     }
 
-    iosvc->lookup_table = list_init(sizeof(struct lookup_table_element));
-    iosvc->allow_new = true;
-    iosvc->running = false;
+    iosvc->lookup_table_pages = lookup_table_pages_count();
+    iosvc->lookup_table = allocate(iosvc->lookup_table_pages *
+                                   sizeof(*iosvc->lookup_table));
 
-    iosvc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-    if (iosvc->epoll_fd < 0) {
-        close(iosvc->event_fd);
+    if (!iosvc->lookup_table) {
+        pthread_mutex_destroy(&iosvc->tasks_mutex);
+        pthread_mutex_destroy(&iosvc->object_mutex);
+        deallocate(iosvc);
+        return NULL;
+    }
+
+    memset(iosvc->lookup_table, 0,
+           iosvc->lookup_table_pages * sizeof(*iosvc->lookup_table));
+
+    iosvc->event_fd = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE | EFD_NONBLOCK);
+
+    if (iosvc->event_fd < 0) {
+        deallocate(iosvc->lookup_table);
+        pthread_mutex_destroy(&iosvc->tasks_mutex);
         pthread_mutex_destroy(&iosvc->object_mutex);
         deallocate(iosvc);
         return NULL;
     }
 
-    memset(&iosvc->event_fd_event, 0, sizeof(iosvc->event_fd_event));
+    atomic_init(&iosvc->lookup_table_count, 0);
+    atomic_init(&iosvc->sync_queue, NULL);
+    atomic_init(&iosvc->requests_count, 0);
+    atomic_init(&iosvc->tasks_posted, NULL);
+    atomic_init(&iosvc->tasks_count, 0);
+    iosvc->tasks_head = NULL;
+    atomic_init(&iosvc->allow_new, true);
+    atomic_init(&iosvc->running, false);
+    atomic_init(&iosvc->now, 0);
+    iosvc->runners = 0;
 
-    iosvc->event_fd_event.events = EPOLLIN;
-    iosvc->event_fd_event.data.fd = iosvc->event_fd;
+    update_now(iosvc);
 
-    if (epoll_ctl(iosvc->epoll_fd, EPOLL_CTL_ADD, iosvc->event_fd, &iosvc->event_fd_event)) {
-        io_service_deinit(iosvc);
+    if (!iosvc->ops->init(iosvc)) {
+        r = errno;
+        close(iosvc->event_fd);
+        deallocate(iosvc->lookup_table);
+        pthread_mutex_destroy(&iosvc->tasks_mutex);
+        pthread_mutex_destroy(&iosvc->object_mutex);
+        deallocate(iosvc);
+        errno = r;
         return NULL;
     }
 
     return iosvc;
 }
 
+io_svc_backend_t io_service_backend(io_service_t *iosvc) {
+    return iosvc->backend;
+}
+
 void io_service_stop(io_service_t *iosvc, bool wait_pending) {
-    pthread_mutex_lock(&iosvc->object_mutex);
-    iosvc->allow_new = false;
-    iosvc->running = wait_pending;
+    object_lock(iosvc);
+    atomic_store(&iosvc->allow_new, false);
+    atomic_store(&iosvc->running, wait_pending);
     notify_svc(iosvc->event_fd);
-    pthread_mutex_unlock(&iosvc->object_mutex);
+    object_unlock(iosvc);
+}
+
+void io_service_params(io_service_t *iosvc, io_service_params_t *params) {
+    if (!iosvc || !params) return;
+
+    params->max_events = iosvc->max_events;
+    params->backend = iosvc->backend;
+    params->fixed_buffers = iosvc->fixed_buffers;
+    params->fixed_buffer_size = iosvc->fixed_buffer_size;
+    params->max_tasks = iosvc->max_tasks;
+    params->spin_usec = iosvc->spin_usec;
+    params->spin_polls = iosvc->spin_polls;
+    params->busy_poll_usec = iosvc->busy_poll_usec;
+    params->timing = iosvc->timing;
+    params->clock = iosvc->clock;
+}
+
+void io_service_stats(io_service_t *iosvc, io_service_stats_t *stats) {
+    if (!iosvc || !stats) return;
+
+    stats->wakeups = atomic_load(&iosvc->stats.wakeups);
+    stats->events = atomic_load(&iosvc->stats.events);
+    stats->full_wakeups = atomic_load(&iosvc->stats.full_wakeups);
+    stats->max_events_per_wakeup = atomic_load(&iosvc->stats.max_events_per_wakeup);
+    stats->max_events = iosvc->max_events;
+    stats->ctl_calls = atomic_load(&iosvc->stats.ctl_calls);
+    stats->ctl_skipped = atomic_load(&iosvc->stats.ctl_skipped);
+    stats->tasks = atomic_load(&iosvc->stats.tasks);
+    stats->spin_wakeups = atomic_load(&iosvc->stats.spin_wakeups);
+    stats->blocks = atomic_load(&iosvc->stats.blocks);
+    stats->spin_nsec = atomic_load(&iosvc->stats.spin_nsec);
+    stats->block_nsec = atomic_load(&iosvc->stats.block_nsec);
+    stats->fds = atomic_load(&iosvc->lookup_table_count);
+    stats->requests_pending = atomic_load(&iosvc->requests_count);
+    stats->tasks_pending = atomic_load(&iosvc->tasks_count);
+    histogram_fetch(&iosvc->stats.events_per_wakeup, &stats->events_per_wakeup);
+    histogram_fetch(&iosvc->stats.callback_nsec, &stats->callback_nsec);
+    histogram_fetch(&iosvc->stats.dispatch_lag_nsec, &stats->dispatch_lag_nsec);
+    histogram_fetch(&iosvc->stats.element_mutex_nsec, &stats->element_mutex_nsec);
+}
+
+size_t io_service_job_stats(io_service_t *iosvc,
+                            io_service_job_stats_t *stats, size_t count) {
+    iosvc_job_stats_t *slot;
+    size_t idx, stored = 0;
+
+    if (!iosvc || !stats) return 0;
+
+    for (idx = 0; idx < IO_SERVICE_JOB_STATS_SLOTS && stored < count; ++idx) {
+        slot = iosvc->stats.job + idx;
+
+        if (!atomic_load(&slot->job)) continue;
+
+        stats[stored].job = (iosvc_job_function_t)atomic_load(&slot->job);
+        stats[stored].calls = atomic_load(&slot->calls);
+        stats[stored].nsec = atomic_load(&slot->nsec);
+        stats[stored].max_nsec = atomic_load(&slot->max_nsec);
+        ++stored;
+    }
+
+    return stored;
 }
 
 void io_service_deinit(io_service_t *iosvc) {
+    size_t idx;
+
+    /* attached objects may remove their jobs */
+    for (idx = 0; idx < IO_SVC_ATTACHMENT_COUNT; ++idx)
+        if (atomic_load(&iosvc->attachment[idx]) && iosvc->attachment_dtor[idx])
+            (*iosvc->attachment_dtor[idx])(atomic_load(&iosvc->attachment[idx]));
+
+    iosvc->ops->deinit(iosvc);
+
     pthread_mutex_destroy(&iosvc->object_mutex);
     close(iosvc->event_fd);
-    close(iosvc->epoll_fd);
 
-    list_deinit(iosvc->lookup_table);
+    lookup_table_deinit(iosvc);
+
+    /* tasks left after the service was stopped */
+    free_tasks(iosvc->tasks_head);
+    free_tasks(atomic_load(&iosvc->tasks_posted));
+    pthread_mutex_destroy(&iosvc->tasks_mutex);
 
     deallocate(iosvc);
 }
 
-void io_service_post_job(io_service_t *iosvc,
-                         int fd, io_svc_op_t op, bool oneshot,
-                         iosvc_job_function_t job,
-                         void *ctx) {
-    pthread_mutex_lock(&iosvc->object_mutex);
+static
+bool post_job(io_service_t *iosvc,
+              int fd, io_svc_op_t op, bool oneshot, bool edge,
+              iosvc_job_function_t job,
+              void *ctx) {
+    lookup_table_element_t *lte;
+    bool posted;
 
-    if (iosvc->allow_new && job) {
-        job_t *new_job;
+    if (fd < 0 || !job) return false;
+    if (!atomic_load(&iosvc->allow_new)) return false;
 
-        lookup_table_element_t *lte;
-        for (lte = list_first_element(iosvc->lookup_table);
-             lte;
-             lte = list_next_element(iosvc->lookup_table, lte))
-            if (lte->fd == fd) break;
+    /* fd is beyond the limit or no memory for the page */
+    lte = lookup_table_get(iosvc, fd, true);
+    if (!lte) return false;
 
-        if (!lte) {
-            lte = list_append(iosvc->lookup_table);
+    element_lock(iosvc, lte);
 
-            assert(lte);
+    if (!lte->used) {
+        lte->used = true;
+        lte->events = 0;
+        memset(lte->job, 0, sizeof(lte->job));
+        atomic_fetch_add(&iosvc->lookup_table_count, 1);
+    }
 
-            lte->event.data.fd = lte->fd = fd;
-            lte->event.events = 0;
-            memset(lte->job, 0, sizeof(lte->job));
-        }
+    posted = lte->job[op].job == NULL;
 
-        if (lte->job[op].job == NULL) {
-            lte->event.events |= OP_FLAGS[op];
-            lte->job[op].job = job;
-            lte->job[op].ctx = ctx;
-            lte->job[op].oneshot = oneshot;
+    if (posted) {
+        lte->events |= OP_FLAGS[op];
+        lte->job[op].job = job;
+        lte->job[op].ctx = ctx;
+        lte->job[op].oneshot = oneshot;
+        lte->job[op].edge = edge;
+        lte->job[op].posted = iosvc->timing ? io_service_now(iosvc) : 0;
 
-            if (iosvc->running) notify_svc(iosvc->event_fd);
-        }
+        lookup_table_update_mode(lte);
+
+        /* re-arming makes kernel report readiness which is there already */
+        if (edge) lte->armed = 0;
+
+        /* busy element is re-armed by its dispatcher */
+        if (!lte->busy && atomic_load(&iosvc->running))
+            iosvc->ops->update(iosvc, lte);
     }
 
-    pthread_mutex_unlock(&iosvc->object_mutex);
+    element_unlock(iosvc, lte);
+
+    return posted;
+}
+
+bool io_service_post_job(io_service_t *iosvc,
+                         int fd, io_svc_op_t op, bool oneshot,
+                         iosvc_job_function_t job,
+                         void *ctx) {
+    return post_job(iosvc, fd, op, oneshot, false, job, ctx);
+}
+
+bool io_service_post_job_edge(io_service_t *iosvc,
+                              int fd, io_svc_op_t op,
+                              iosvc_job_function_t job, void *ctx) {
+    return post_job(iosvc, fd, op, false, iosvc->ops->edge_triggered,
+                    job, ctx);
 }
 
 void io_service_run(io_service_t *iosvc) {
-    pthread_mutex_t *mutex = &iosvc->object_mutex;
-    bool *running = &iosvc->running;
-    struct epoll_event event;
-    int epoll_fd = iosvc->epoll_fd;
+    size_t max_events = iosvc->max_events;
+    struct epoll_event *events;
+    io_service_t *prev_service = current_service;
     int event_fd = iosvc->event_fd;
-    int r, fd;
-    ssize_t idx;
-    io_svc_op_t op;
-    lookup_table_element_t *lte, *prev_lte;
-    iosvc_job_function_t job;
-    void *ctx;
+    int r, idx;
+    bool notified;
 
-    pthread_mutex_lock(mutex);
+    object_lock(iosvc);
 
-    for (lte = list_first_element(iosvc->lookup_table);
-         lte;
-         lte = list_next_element(iosvc->lookup_table, lte))
-        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, lte->fd, &lte->event);
+    /* stopped without waiting for pending jobs before it ran */
+    if (!atomic_load(&iosvc->allow_new) && !atomic_load(&iosvc->running)) {
+        object_unlock(iosvc);
+        return;
+    }
 
-    *running = true;
+    if (iosvc->runners++ == 0) {
+        atomic_store(&iosvc->running, true);
+        iosvc_lookup_table_sync_all(iosvc);
+    }
 
-    while (*running) {
-        pthread_mutex_unlock(mutex);
-        r = epoll_wait(epoll_fd, &event, 1, -1);
-        pthread_mutex_lock(mutex);
+    object_unlock(iosvc);
 
-        if (r < 0) continue;
+    events = allocate(max_events * sizeof(*events));
+    assert(events);
 
-        fd = event.data.fd;
+    current_service = iosvc;
 
-        if (fd == event_fd) {
-            svc_notified(fd);
+    while (atomic_load(&iosvc->running)) {
+        r = wait_events(iosvc, events, max_events);
 
-            if ((list_size(iosvc->lookup_table) == 0) && (iosvc->allow_new == false))
-                *running = false;
+        if (r <= 0) continue;
 
-            for (lte = list_first_element(iosvc->lookup_table); lte;) {
-                if (lte->event.events == 0) {
-                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, lte->fd, NULL);
-                    lte = list_remove_next(iosvc->lookup_table, lte);
-                    continue;
-                }
+        update_now(iosvc);
 
-                if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, lte->fd, &lte->event))
-                    if (errno == ENOENT)
-                        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, lte->fd, &lte->event);
+        update_stats(iosvc, r);
 
-                lte = list_next_element(iosvc->lookup_table, lte);
+        notified = false;
+
+        for (idx = 0; idx < r && atomic_load(&iosvc->running); ++idx) {
+            /* handle notification after the whole batch is dispatched */
+            if (events[idx].data.ptr == NULL) {
+                notified = true;
+                continue;
             }
 
-            continue;
-        } /* if (fd == event_fd) */
+            if ((uintptr_t)events[idx].data.ptr & IOSVC_REQUEST_TAG)
+                dispatch_request(iosvc,
+                                 (void *)((uintptr_t)events[idx].data.ptr &
+                                          ~IOSVC_REQUEST_TAG));
+            else
+                dispatch_element(iosvc, events[idx].data.ptr,
+                                 events[idx].events);
+        }   /* for (idx = 0; idx < r && running; ++idx) */
 
-        for (op = 0; op < IO_SVC_OP_COUNT; ++op) {
-            if (!(event.events & OP_FLAGS[op])) continue;
-
-            for (lte = list_first_element(iosvc->lookup_table);
-                 lte;
-                 lte = list_next_element(iosvc->lookup_table, lte))
-                if (lte->fd == fd) {
-                    if (lte->job[op].job != NULL) break;
-                    else {
-                        lte = NULL;
-                        break;
-                    }
-                }
-
-            if (lte) {
-                job = lte->job[op].job;
-                ctx = lte->job[op].ctx;
-
-                if (lte->job[op].oneshot) {
-                    lte->job[op].ctx = lte->job[op].job = NULL;
-                    lte->event.events &= ~OP_FLAGS[op];
-
-                    if (lte->event.events == 0) {
-                        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, lte->fd, NULL);
-                        list_remove_element(iosvc->lookup_table, lte);
-                    }
-                }
-
-                pthread_mutex_unlock(mutex);
-                (*job)(fd, op, ctx);
-                pthread_mutex_lock(mutex);
-            } /* if (lte) */
-        }   /* for (op = 0; op < IO_SVC_OP_COUNT; ++op) */
-    }   /* while (*running) */
+        if (notified) {
+            svc_notified(event_fd);
+
+            /* apply pending changes first as these may release elements */
+            iosvc->ops->notified(iosvc);
+
+            run_tasks(iosvc);
+
+            if ((atomic_load(&iosvc->lookup_table_count) == 0) &&
+                (atomic_load(&iosvc->requests_count) == 0) &&
+                (atomic_load(&iosvc->tasks_count) == 0) &&
+                (atomic_load(&iosvc->allow_new) == false))
+                atomic_store(&iosvc->running, false);
+
+            iosvc->ops->rearm_notification(iosvc);
+        } /* if (notified) */
+    }   /* while (running) */
 
-    pthread_mutex_unlock(mutex);
+    object_lock(iosvc);
+    --iosvc->runners;
+    object_unlock(iosvc);
+
+    /* wake up the rest of runners so that they notice the stop */
+    iosvc->ops->rearm_notification(iosvc);
+    notify_svc(event_fd);
+
+    current_service = prev_service;
+
+    deallocate(events);
+}
+
+uint64_t io_service_now(io_service_t *iosvc) {
+    if (current_service != iosvc) return update_now(iosvc);
+
+    return atomic_load_explicit(&iosvc->now, memory_order_relaxed);
 }
 
 void io_service_remove_job(io_service_t *iosvc,
                            int fd, io_svc_op_t op,
                            iosvc_job_function_t job, void *ctx) {
     lookup_table_element_t *lte;
-    bool done = false;
 
-    pthread_mutex_lock(&iosvc->object_mutex);
+    if (fd < 0) return;
 
-    for (lte = list_first_element(iosvc->lookup_table);
-         lte;
-         lte = list_next_element(iosvc->lookup_table, lte))
-        if (lte->fd == fd)
-            if (lte->job[op].job == job && lte->job[op].ctx == ctx) {
-                lte->job[op].job = NULL;
-                lte->job[op].ctx = NULL;
-                lte->event.events &= ~OP_FLAGS[op];
-                done = true;
-                break;
-            }
+    lte = lookup_table_get(iosvc, fd, false);
 
-    if (done && iosvc->running) notify_svc(iosvc->event_fd);
-    pthread_mutex_unlock(&iosvc->object_mutex);
-}
\ No newline at end of file
+    if (!lte) return;
+
+    element_lock(iosvc, lte);
+
+    if (lte->used &&
+        lte->job[op].job == job && lte->job[op].ctx == ctx) {
+        lte->job[op].job = NULL;
+        lte->job[op].ctx = NULL;
+        lte->events &= ~OP_FLAGS[op];
+
+        lookup_table_update_mode(lte);
+
+        if (!lte->busy && atomic_load(&iosvc->running))
+            iosvc->ops->update(iosvc, lte);
+
+        /* the job may have been fetched by another runner already,
+         * its context is not referred to once this returns
+         */
+        while (lte->busy && !pthread_equal(lte->dispatcher, pthread_self()))
+            pthread_cond_wait(&lte->idle, &lte->mutex);
+    }
+
+    element_unlock(iosvc, lte);
+}
+
+void *io_service_attach(io_service_t *iosvc, io_svc_attachment_t slot,
+                        void *obj, iosvc_attachment_dtor_t dtor) {
+    void *attached;
+
+    if (!iosvc || slot >= IO_SVC_ATTACHMENT_COUNT) return NULL;
+
+    object_lock(iosvc);
+
+    attached = atomic_load(&iosvc->attachment[slot]);
+
+    if (!attached) {
+        iosvc->attachment_dtor[slot] = dtor;
+        atomic_store(&iosvc->attachment[slot], obj);
+        attached = obj;
+    }
+
+    object_unlock(iosvc);
+
+    return attached;
+}
+
+void *io_service_attachment(io_service_t *iosvc, io_svc_attachment_t slot) {
+    if (!iosvc || slot >= IO_SVC_ATTACHMENT_COUNT) return NULL;
+
+    return atomic_load(&iosvc->attachment[slot]);
+}
+
+bool io_service_post_task(io_service_t *iosvc,
+                          iosvc_task_function_t fn, void *ctx) {
+    iosvc_task_t *task, *head;
+
+    if (!fn) return false;
+    if (!atomic_load(&iosvc->allow_new)) return false;
+
+    task = allocate(sizeof(iosvc_task_t));
+    if (!task) return false;
+
+    task->fn = fn;
+    task->ctx = ctx;
+
+    atomic_fetch_add(&iosvc->tasks_count, 1);
+
+    head = atomic_load_explicit(&iosvc->tasks_posted, memory_order_relaxed);
+
+    do {
+        task->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&iosvc->tasks_posted,
+                                                    &head, task,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+
+    /* the runner which takes the stack finds out the rest of tasks */
+    if (!head) notify_svc(iosvc->event_fd);
+
+    return true;
+}
+
+bool io_service_submit_msg(io_service_t *iosvc,
+                           int fd, io_svc_op_t op,
+                           struct msghdr *msg, int flags,
+                           iosvc_completion_function_t cb, void *ctx) {
+    iosvc_request_t *req;
+
+    if (fd < 0 || !cb || !msg || !iosvc->ops->submit) return false;
+    if (!atomic_load(&iosvc->allow_new)) return false;
+
+    req = allocate(sizeof(iosvc_request_t));
+    if (!req) return false;
+
+    req->fd = fd;
+    req->op = op;
+    req->res = 0;
+    req->cb = cb;
+    req->ctx = ctx;
+    req->slot = -1;
+    req->data = NULL;
+    req->len = 0;
+    req->msg = msg;
+    req->flags = flags;
+
+    return submit_request(iosvc, req);
+}
+
+bool io_service_submit_read_fixed(io_service_t *iosvc,
+                                  int fd, void *data, size_t len,
+                                  iosvc_completion_function_t cb, void *ctx) {
+    iosvc_request_t *req;
+
+    if (fd < 0 || !cb || !data || !iosvc->ops->submit) return false;
+    if (len == 0 || len > iosvc->fixed_buffer_size) return false;
+    if (!atomic_load(&iosvc->allow_new)) return false;
+
+    req = allocate(sizeof(iosvc_request_t));
+    if (!req) return false;
+
+    req->fd = fd;
+    req->op = IO_SVC_OP_READ;
+    req->res = 0;
+    req->cb = cb;
+    req->ctx = ctx;
+    req->slot = -1;
+    req->data = data;
+    req->len = len;
+    req->msg = NULL;
+    req->flags = 0;
+
+    return submit_request(iosvc, req);
+}
@@ -4,6 +4,7 @@
 # include "common.h"
 
 # include <stdbool.h>
+# include <stdint.h>
 
 /** IO service operation
  * read/write
@@ -20,16 +21,211 @@ struct io_service;
 typedef struct io_service io_service_t;
 
 typedef void (*iosvc_job_function_t)(int fd, io_svc_op_t op, void *ctx);
+typedef void (*iosvc_task_function_t)(void *ctx);
+/** Completion callback of submitted operation
+ * \param [in] res result of operation as returned by syscall or -errno
+ */
+typedef void (*iosvc_completion_function_t)(int fd, io_svc_op_t op, int res,
+                                            void *ctx);
+
+struct msghdr;
+
+/** IO service backend
+ * epoll/io_uring
+ */
+typedef enum io_svc_backend {
+    IO_SVC_BACKEND_EPOLL = 0,
+    IO_SVC_BACKEND_URING = 1,
+    IO_SVC_BACKEND_COUNT
+} io_svc_backend_t;
+
+/** Source of cached time of the service
+ * Coarse clock is cheaper to read but has a resolution of a scheduler
+ * tick, a few milliseconds usually.
+ */
+typedef enum io_svc_clock {
+    IO_SVC_CLOCK_MONOTONIC = 0,
+    IO_SVC_CLOCK_MONOTONIC_COARSE = 1,
+    IO_SVC_CLOCK_COUNT
+} io_svc_clock_t;
+
+/** Objects other modules attach to the service
+ */
+typedef enum io_svc_attachment {
+    IO_SVC_ATTACHMENT_TIMERS = 0,
+    IO_SVC_ATTACHMENT_COUNT
+} io_svc_attachment_t;
+
+typedef void (*iosvc_attachment_dtor_t)(void *obj);
+
+# define IO_SERVICE_DEFAULT_MAX_EVENTS 64
+# define IO_SERVICE_DEFAULT_MAX_TASKS 64
+# define IO_SERVICE_DEFAULT_FIXED_BUFFERS 256
+# define IO_SERVICE_DEFAULT_FIXED_BUFFER_SIZE 64
+# define IO_SERVICE_JOB_STATS_SLOTS 64
+
+/** IO service parameters
+ */
+typedef struct io_service_params {
+    size_t max_events;                                      ///< events harvested per wakeup
+    io_svc_backend_t backend;
+    size_t fixed_buffers;                                   ///< count of buffers registered with kernel
+    size_t fixed_buffer_size;                               ///< size of single registered buffer
+    size_t max_tasks;                                       ///< tasks executed per wakeup
+    unsigned long spin_usec;                                ///< time to poll for events before blocking
+    size_t spin_polls;                                      ///< empty polls before blocking
+    unsigned busy_poll_usec;                                ///< SO_BUSY_POLL for sockets of network layer
+    bool timing;                                            ///< measure callback, lock and lag times
+    io_svc_clock_t clock;                                   ///< source of io_service_now
+} io_service_params_t;
+
+/** IO service statistics snapshot
+ */
+typedef struct io_service_stats {
+    unsigned long long wakeups;                             ///< returns from wait with events
+    unsigned long long events;                              ///< events harvested in total
+    unsigned long long full_wakeups;                        ///< wakeups which filled the whole batch
+    size_t max_events_per_wakeup;
+    size_t max_events;                                      ///< configured batch size
+    unsigned long long ctl_calls;                           ///< registration changes issued to kernel
+    unsigned long long ctl_skipped;                         ///< syncs with registration up to date
+    unsigned long long tasks;                               ///< tasks executed in total
+    unsigned long long spin_wakeups;                        ///< wakeups found by polling
+    unsigned long long blocks;                              ///< waits blocked after spinning
+    unsigned long long spin_nsec;                           ///< time spent polling
+    unsigned long long block_nsec;                          ///< time spent blocked after spinning
+    size_t fds;                                             ///< fds with jobs posted
+    size_t requests_pending;                                ///< submitted operations not completed
+    size_t tasks_pending;                                   ///< posted tasks not executed
+    histogram_t events_per_wakeup;
+    /* measured if timing parameter is set */
+    histogram_t callback_nsec;                              ///< job execution time
+    histogram_t dispatch_lag_nsec;                          ///< time from job post to its dispatch
+    histogram_t element_mutex_nsec;                         ///< time fd mutex is held by dispatch, post and remove
+} io_service_stats_t;
+
+/** Execution time of single job function
+ */
+typedef struct io_service_job_stats {
+    iosvc_job_function_t job;
+    unsigned long long calls;
+    unsigned long long nsec;
+    unsigned long long max_nsec;
+} io_service_job_stats_t;
 
 io_service_t *io_service_init();
+/** IO service c-tor
+ * \param [in] params parameters, defaults are used for \c NULL
+ * \return \c NULL with errno set on failure. \c ENOSYS is set if
+ *         requested backend is not available.
+ */
+io_service_t *io_service_init_params(const io_service_params_t *params);
+io_svc_backend_t io_service_backend(io_service_t *iosvc);
+/** Fetch parameters the service was initialized with, defaults applied
+ */
+void io_service_params(io_service_t *iosvc, io_service_params_t *params);
+/** Fetch statistics snapshot.
+ * \c ctl_calls divided by \c wakeups gives registration syscalls per
+ * loop iteration.
+ */
+void io_service_stats(io_service_t *iosvc, io_service_stats_t *stats);
+/** Fetch execution times per job function, timing parameter is required
+ * At most \c IO_SERVICE_JOB_STATS_SLOTS functions are tracked.
+ * \return count of entries stored to \c stats
+ */
+size_t io_service_job_stats(io_service_t *iosvc,
+                            io_service_job_stats_t *stats, size_t count);
 void io_service_stop(io_service_t *iosvc, bool wait_pending);
 void io_service_deinit(io_service_t *iosvc);
-void io_service_post_job(io_service_t *iosvc,
+/** Post job to be called once fd is ready for the operation
+ * \return \c false if the service is stopped, a job is posted for the fd
+ *         and operation already, fd is beyond the limit of the process or
+ *         no memory is available
+ */
+bool io_service_post_job(io_service_t *iosvc,
                          int fd, io_svc_op_t op, bool oneshot,
                          iosvc_job_function_t job, void *ctx);
+/** Post persistent edge triggered job
+ * The job is called every time the fd becomes ready and stays posted
+ * until removed with io_service_remove_job. It should read/write until
+ * EAGAIN since readiness is not reported again otherwise. Readiness which
+ * is there already when the job is posted is reported.
+ * The whole fd is registered edge triggered while it has such a job.
+ * Backends without edge triggered registrations keep the job as
+ * persistent level triggered one.
+ * \return \c false on the same conditions as \c io_service_post_job
+ */
+bool io_service_post_job_edge(io_service_t *iosvc,
+                              int fd, io_svc_op_t op,
+                              iosvc_job_function_t job, void *ctx);
+/** Run the service loop
+ * May be called from several threads at once. Jobs of a single fd are
+ * never dispatched to more than one thread at a time.
+ * If \c spin_usec or \c spin_polls parameter is set, the loop polls for
+ * events until either is exhausted and only then blocks.
+ * Returns right away if the service is stopped without waiting for
+ * pending jobs already.
+ */
 void io_service_run(io_service_t *iosvc);
+/** Remove job posted for fd and operation
+ * If jobs of the fd are dispatched by another thread, waits until these
+ * return, so that \c ctx may be freed once this returns.
+ */
 void io_service_remove_job(io_service_t *iosvc,
                            int fd, io_svc_op_t op,
                            iosvc_job_function_t job, void *ctx);
 
+/** Cached monotonic time in nanoseconds
+ * The time is read from \c clock source once per wakeup of a thread
+ * running the service before jobs of the wakeup are dispatched. Callbacks
+ * may use it instead of reading the clock themselves. The time never goes
+ * back but lags behind the clock by the time spent since the wakeup.
+ * Threads which are not running the service read the clock and refresh
+ * the cached time.
+ */
+uint64_t io_service_now(io_service_t *iosvc);
+
+/** Attach object to the service unless there is one attached already
+ * Attached object is destroyed with \c dtor at the beginning of
+ * \c io_service_deinit.
+ * \return object attached to the slot, \c obj or the one attached before
+ */
+void *io_service_attach(io_service_t *iosvc, io_svc_attachment_t slot,
+                        void *obj, iosvc_attachment_dtor_t dtor);
+/** Fetch object attached to the service, \c NULL if there is none
+ */
+void *io_service_attachment(io_service_t *iosvc, io_svc_attachment_t slot);
+
+/** Post task to be executed by a thread running the service
+ * Tasks are executed in order of posting, at most \c max_tasks of them
+ * per wakeup so that I/O events are not starved.
+ * Tasks not executed before the service is stopped without waiting for
+ * pending ones are dropped.
+ * \return \c false if the service is stopped or no memory is available
+ */
+bool io_service_post_task(io_service_t *iosvc,
+                          iosvc_task_function_t fn, void *ctx);
+
+/** Submit sendmsg/recvmsg operation to be executed by the service
+ * \c msg should stay valid until \c cb is called.
+ * Available with io_uring backend only.
+ * Operations still in kernel at \c io_service_deinit are cancelled and
+ * their callbacks are called with the result, \c -ECANCELED usually.
+ * \return \c false if operation was not submitted
+ */
+bool io_service_submit_msg(io_service_t *iosvc,
+                           int fd, io_svc_op_t op,
+                           struct msghdr *msg, int flags,
+                           iosvc_completion_function_t cb, void *ctx);
+/** Submit read of at most fixed buffer size bytes into \c data
+ * Read is performed into buffer registered with kernel, data is copied
+ * to \c data before \c cb is called.
+ * Available with io_uring backend only.
+ * \return \c false if operation was not submitted, e.g. all of fixed
+ *         buffers are in use or \c len is too large
+ */
+bool io_service_submit_read_fixed(io_service_t *iosvc,
+                                  int fd, void *data, size_t len,
+                                  iosvc_completion_function_t cb, void *ctx);
+
 #endif /* _IO_SERVICE_H_ */
\ No newline at end of file
@@ -30,6 +30,7 @@ struct client_tcp {
     char *local_port;
     endpoint_socket_t local;
     endpoint_socket_t remote;
+    tcp_stream_t *stream;                                   ///< async operations, created on connect
 };
 
 struct client_udp {
@@ -139,6 +140,7 @@ void client_tcp_connector(int fd, io_svc_op_t op, void *ctx) {
     assert(ret == 0);
 
     client->connected = true;
+    client->stream = tcp_stream_init(client->master, client->local.skt);
 
     if (err)
         client_tcp_disconnect(client);
@@ -178,6 +180,7 @@ client_tcp_t *client_tcp_init(io_service_t *svc,
     client->remote.ep.ep_type = client->local.ep.ep_type = EPT_NONE;
     client->remote.ep.ep_class = client->local.ep.ep_class = EPC_NONE;
     client->local.skt = -1;
+    client->stream = NULL;
 
     if (addr) client->local_addr = strdup(addr);
     if (port) client->local_port = strdup(port);
@@ -194,12 +197,20 @@ fail:
     return NULL;
 }
 
+client_tcp_t *client_tcp_init_group(io_service_group_t *grp,
+                                    const char *addr, const char *port,
+                                    int reuse_addr) {
+    return client_tcp_init(io_service_group_next(grp),
+                           addr, port, reuse_addr);
+}
+
 void client_tcp_deinit(client_tcp_t *client) {
     if (!client) return;
 
+    /* not under the mutex, see client_tcp_disconnect */
+    client_tcp_disconnect(client);
+
     pthread_mutex_lock(&client->mutex);
-    if (client->connected)
-        client_tcp_disconnect(client);
 
     shutdown(client->local.skt, SHUT_RDWR);
     close(client->local.skt);
@@ -214,6 +225,9 @@ void client_tcp_deinit(client_tcp_t *client) {
 }
 
 void client_tcp_disconnect(client_tcp_t *client) {
+    tcp_stream_t *stream;
+    int skt;
+
     if (!client) return;
 
     pthread_mutex_lock(&client->mutex);
@@ -223,12 +237,19 @@ void client_tcp_disconnect(client_tcp_t *client) {
         return;
     }
 
-    shutdown(client->local.skt, SHUT_RDWR);
-    close(client->local.skt);
+    stream = client->stream;
+    client->stream = NULL;
+    skt = client->local.skt;
     client->local.skt = -1;
     client->connected = false;
 
     pthread_mutex_unlock(&client->mutex);
+
+    /* waits for callbacks which may lock the client */
+    tcp_stream_deinit(stream);
+
+    shutdown(skt, SHUT_RDWR);
+    close(skt);
 }
 
 void client_tcp_local_ep(client_tcp_t *client, endpoint_t **ep) {
@@ -276,6 +297,8 @@ void client_tcp_connect_sync(client_tcp_t *client,
         return;
     }
 
+    network_busy_poll(client->master, client->local.skt);
+
     memset(&hint, 0, sizeof(hint));
     hint.ai_family = client->local.ep.ep_class == EPC_IP4
                       ? AF_INET
@@ -305,6 +328,7 @@ void client_tcp_connect_sync(client_tcp_t *client,
     translate_endpoint(&client->remote.ep);
 
     client->connected = true;
+    client->stream = tcp_stream_init(client->master, client->local.skt);
     ep = &client->remote.ep;
 
     if (errno) {
@@ -343,6 +367,8 @@ void client_tcp_connect_async(client_tcp_t *client,
         return;
     }
 
+    network_busy_poll(client->master, client->local.skt);
+
     connector = allocate(sizeof(struct connector));
     assert(connector);
 
@@ -375,12 +401,15 @@ void client_tcp_connect_async(client_tcp_t *client,
             client->remote.ep.ep_type = EPT_TCP;
             memcpy(&client->remote.ep.addr, cur_addr->ai_addr, cur_addr->ai_addrlen);
             translate_endpoint(&client->remote.ep);
-            io_service_post_job(client->master,
-                                client->local.skt,
-                                IO_SVC_OP_WRITE,
-                                true,
-                                client_tcp_connector,
-                                connector);
+            if (!io_service_post_job(client->master,
+                                     client->local.skt,
+                                     IO_SVC_OP_WRITE,
+                                     true,
+                                     client_tcp_connector,
+                                     connector)) {
+                if (cb) (*cb)(NULL, ECANCELED, ctx);
+                deallocate(connector);
+            }
             break;
         }
     }
@@ -412,6 +441,7 @@ void client_tcp_recv_sync(client_tcp_t *client, buffer_t *buffer,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_RECV;
     srb->iosvc = NULL;
+    srb->stream = NULL;
     srb->aux.src = client->remote;
     srb->aux.dst.skt = -1;
 
@@ -437,6 +467,7 @@ void client_tcp_recv_async(client_tcp_t *client, buffer_t *buffer,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_RECV;
     srb->iosvc = client->master;
+    srb->stream = client->stream;
     srb->aux.src = client->remote;
     srb->aux.dst.skt = -1;
 
@@ -462,6 +493,7 @@ void client_tcp_send_sync(client_tcp_t *client, buffer_t *buffer,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_SEND;
     srb->iosvc = NULL;
+    srb->stream = NULL;
     srb->aux.src.skt = -1;
     srb->aux.dst = client->remote;
 
@@ -487,6 +519,7 @@ void client_tcp_send_async(client_tcp_t *client, buffer_t *buffer,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_SEND;
     srb->iosvc = client->master;
+    srb->stream = client->stream;
     srb->aux.src.skt = -1;
     srb->aux.dst = client->remote;
 
@@ -523,6 +556,8 @@ client_udp_t *client_udp_init(io_service_t *svc,
                             client->local_addr, client->local_port,
                             client->reuse_addr, &client->local)) goto fail_socket;
 
+    network_busy_poll(client->master, client->local.skt);
+
     return client;
 
 fail_socket:
@@ -584,6 +619,7 @@ void client_udp_recv_sync(client_udp_t *client,
     srb->operation.type = EPT_UDP;
     srb->operation.op = SRB_OP_RECV;
     srb->iosvc = NULL;
+    srb->stream = NULL;
     srb->aux.src.skt = client->local.skt;
     srb->aux.src.ep.ep_type = EPT_UDP;
     srb->aux.dst.skt = -1;
@@ -611,6 +647,7 @@ void client_udp_recv_async(client_udp_t *client,
     srb->operation.type = EPT_UDP;
     srb->operation.op = SRB_OP_RECV;
     srb->iosvc = client->master;
+    srb->stream = NULL;
     srb->aux.src.skt = client->local.skt;
     srb->aux.src.ep.ep_type = EPT_UDP;
     srb->aux.dst.skt = -1;
@@ -675,6 +712,7 @@ void client_udp_send_sync(client_udp_t *client,
     srb->operation.type = EPT_UDP;
     srb->operation.op = SRB_OP_SEND;
     srb->iosvc = NULL;
+    srb->stream = NULL;
     srb->aux.src.skt = -1;
     srb->aux.dst.skt = client->local.skt;
     srb->aux.dst.ep.ep_type = EPT_UDP;
@@ -738,6 +776,7 @@ void client_udp_send_async(client_udp_t *client,
     srb->operation.type = EPT_UDP;
     srb->operation.op = SRB_OP_SEND;
     srb->iosvc = client->master;
+    srb->stream = NULL;
     srb->aux.src.skt = -1;
     srb->aux.dst.skt = client->local.skt;
     srb->aux.dst.ep.ep_type = EPT_UDP;
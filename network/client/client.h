@@ -4,6 +4,7 @@
 # include "network.h"
 # include "endpoint.h"
 # include "io-service.h"
+# include "io-service-group.h"
 # include "memory.h"
 
 struct client_tcp;
@@ -15,6 +16,11 @@ typedef struct client_udp client_udp_t;
 client_tcp_t *client_tcp_init(io_service_t *svc,
                               const char *addr, const char *port,
                               int reuse_addr);
+/** Client bound to a service picked from the group for its lifetime
+ */
+client_tcp_t *client_tcp_init_group(io_service_group_t *grp,
+                                    const char *addr, const char *port,
+                                    int reuse_addr);
 void client_tcp_deinit(client_tcp_t *client);
 void client_tcp_connect_sync(client_tcp_t *client,
                              const char *addr, const char *port,
@@ -8,6 +8,8 @@
 typedef struct connection {
     void *host;
     endpoint_socket_t ep_skt;
+    io_service_t *iosvc;                                    ///< service the connection is bound to
+    tcp_stream_t *stream;                                   ///< async operations, may be NULL
 } connection_t;
 
 #endif /* _CHATS_CONNECTION_H_ */
\ No newline at end of file
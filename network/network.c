@@ -14,7 +14,9 @@
 #include <linux/sockios.h>
 
 #include <errno.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 typedef ssize_t (*NET_OPERATOR)(int sockfd, struct msghdr *msg, int flags);
 
@@ -77,63 +79,373 @@ static const OPERATOR OPERATORS[] = {
 };
 
 /***************** functions *********************/
+static void tcp_send_recv_async_tpl(int fd, io_svc_op_t op_, void *ctx);
+static void tcp_send_recv_complete(int fd, io_svc_op_t op_, int res,
+                                   void *ctx);
+
+/* submit the rest of srb buffer as completion based operation.
+ * Short receives (e.g. protocol headers) go to registered buffers.
+ */
 static
-void tcp_send_recv_async_tpl(int fd, io_svc_op_t op_, void *ctx) {
-    srb_t *srb = ctx;
+bool tcp_send_recv_submit(srb_t *srb, int fd) {
     buffer_t *buffer = srb->buffer;
     size_t bytes_op = srb->bytes_operated;
     srb_operation_t op = srb->operation.op;
-    io_service_t *iosvc = srb->iosvc;
-    NET_OPERATOR oper = NET_OPERATIONS[op].oper;
-    io_svc_op_t io_svc_op = NET_OPERATIONS[op].iosvc_op;
-    ssize_t bytes_op_cur;
-    int more_bytes;
-    endpoint_t *ep_ptr;
 
-    errno = 0;
     srb->vec.iov_base = buffer_data(buffer) + bytes_op;
     srb->vec.iov_len = buffer_size(buffer) - bytes_op;
-    bytes_op_cur = (*oper)(fd,
-                           &srb->mhdr,
-                           MSG_NOSIGNAL | MSG_DONTWAIT);
 
-    if (bytes_op_cur < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-            io_service_post_job(iosvc,
-                                fd,
-                                io_svc_op,
-                                true,
-                                tcp_send_recv_async_tpl,
-                                srb);
-        else {
-            ep_ptr = op == SRB_OP_SEND
-                            ? &srb->aux.dst.ep
-                            : &srb->aux.src.ep;
-            if (srb->cb)
-                (*srb->cb)(*ep_ptr, errno, bytes_op, more_bytes, buffer, srb->ctx);
-            deallocate(srb);
+    if (op == SRB_OP_RECV &&
+        io_service_submit_read_fixed(srb->iosvc, fd,
+                                     srb->vec.iov_base, srb->vec.iov_len,
+                                     tcp_send_recv_complete, srb))
+        return true;
+
+    return io_service_submit_msg(srb->iosvc, fd,
+                                 NET_OPERATIONS[op].iosvc_op,
+                                 &srb->mhdr, MSG_NOSIGNAL,
+                                 tcp_send_recv_complete, srb);
+}
+
+static
+void tcp_send_recv_complete(int fd, io_svc_op_t op_, int res, void *ctx) {
+    srb_t *srb = ctx;
+    buffer_t *buffer = srb->buffer;
+    srb_operation_t op = srb->operation.op;
+    int more_bytes = 0;
+    int err = 0;
+    endpoint_t *ep_ptr;
+
+    if (res < 0)
+        err = -res;
+    else if (res == 0)
+        /* peer closed the connection */
+        err = ECONNRESET;
+    else {
+        srb->bytes_operated += res;
+
+        if (srb->bytes_operated < buffer_size(buffer)) {
+            if (tcp_send_recv_submit(srb, fd) ||
+                io_service_post_job_edge(srb->iosvc,
+                                         fd,
+                                         NET_OPERATIONS[op].iosvc_op,
+                                         tcp_send_recv_async_tpl,
+                                         srb))
+                return;
+
+            /* nothing would operate the rest of the buffer */
+            err = ECANCELED;
         }
+        else
+            assert(0 == ioctl(fd, NET_OPERATIONS[op].ioctl_request, &more_bytes));
     }
+
+    ep_ptr = op == SRB_OP_SEND
+                    ? &srb->aux.dst.ep
+                    : &srb->aux.src.ep;
+    if (srb->cb)
+        (*srb->cb)(*ep_ptr, err, srb->bytes_operated, more_bytes, buffer, srb->ctx);
+    deallocate(srb);
+}
+
+static
+void udp_send_complete(int fd, io_svc_op_t op_, int res, void *ctx) {
+    srb_t *srb = ctx;
+    int more_bytes = 0;
+    int err = 0;
+
+    if (res < 0)
+        err = -res;
     else {
+        srb->bytes_operated = res;
+        assert(0 == ioctl(fd, NET_OPERATIONS[SRB_OP_SEND].ioctl_request, &more_bytes));
+    }
+
+    if (srb->cb)
+        (*srb->cb)(srb->aux.dst.ep, err, srb->bytes_operated, more_bytes,
+                   srb->buffer, srb->ctx);
+    deallocate(srb);
+}
+
+/* operate the rest of the buffer until EAGAIN, error or the buffer is done
+ * \return -1 to wait for the next edge, errno otherwise
+ */
+static
+int tcp_send_recv_step(int fd, srb_t *srb) {
+    buffer_t *buffer = srb->buffer;
+    size_t bytes_op = srb->bytes_operated;
+    srb_operation_t op = srb->operation.op;
+    NET_OPERATOR oper = NET_OPERATIONS[op].oper;
+    ssize_t bytes_op_cur;
+
+    do {
+        errno = 0;
+        srb->vec.iov_base = buffer_data(buffer) + bytes_op;
+        srb->vec.iov_len = buffer_size(buffer) - bytes_op;
+        bytes_op_cur = (*oper)(fd,
+                               &srb->mhdr,
+                               MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (bytes_op_cur < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                srb->bytes_operated = bytes_op;
+                return -1;
+            }
+
+            break;
+        }
+
+        /* peer closed the connection */
+        if (bytes_op_cur == 0 && op == SRB_OP_RECV) {
+            errno = ECONNRESET;
+            break;
+        }
+
         bytes_op += bytes_op_cur;
-        srb->bytes_operated = bytes_op;
-        if (bytes_op < buffer_size(buffer))
-            io_service_post_job(iosvc,
-                                fd,
-                                io_svc_op,
-                                true,
-                                tcp_send_recv_async_tpl,
-                                srb);
-        else {
-            assert(0 == ioctl(fd, NET_OPERATIONS[op].ioctl_request, &more_bytes));
-            ep_ptr = op == SRB_OP_SEND
-                            ? &srb->aux.dst.ep
-                            : &srb->aux.src.ep;
-            if (srb->cb)
-                (*srb->cb)(*ep_ptr, errno, bytes_op, more_bytes, buffer, srb->ctx);
-            deallocate(srb);
+    } while (bytes_op < buffer_size(buffer));
+
+    srb->bytes_operated = bytes_op;
+
+    return errno;
+}
+
+/* report operated buffer and free it */
+static
+void tcp_send_recv_done(int fd, srb_t *srb, int err) {
+    srb_operation_t op = srb->operation.op;
+    int more_bytes = 0;
+    endpoint_t *ep_ptr;
+
+    if (!err)
+        assert(0 == ioctl(fd, NET_OPERATIONS[op].ioctl_request, &more_bytes));
+
+    ep_ptr = op == SRB_OP_SEND
+                    ? &srb->aux.dst.ep
+                    : &srb->aux.src.ep;
+    if (srb->cb)
+        (*srb->cb)(*ep_ptr, err, srb->bytes_operated, more_bytes,
+                   srb->buffer, srb->ctx);
+    deallocate(srb);
+}
+
+/* edge triggered job, operates until EAGAIN or the buffer is done */
+static
+void tcp_send_recv_async_tpl(int fd, io_svc_op_t op_, void *ctx) {
+    srb_t *srb = ctx;
+    int err = tcp_send_recv_step(fd, srb);
+
+    /* wait for the next edge */
+    if (err < 0) return;
+
+    /* let the callback post next operation for the fd */
+    io_service_remove_job(srb->iosvc, fd,
+                          NET_OPERATIONS[srb->operation.op].iosvc_op,
+                          tcp_send_recv_async_tpl, srb);
+
+    tcp_send_recv_done(fd, srb, err);
+}
+
+/* Stream of a connection has edge triggered job posted per operation
+ * once, on its first buffer, and removed on deinit only. Buffers are
+ * queued per operation. The one at the head is operated by either the
+ * thread queueing it, as the socket may be ready already, or the job on
+ * the next edge. Edge arriving while the buffer is operated makes the
+ * operating thread retry instead.
+ */
+struct tcp_stream {
+    io_service_t *iosvc;
+    int skt;
+    pthread_mutex_t mutex;                                  ///< guards everything below
+    bool closing;
+    /* owner and threads operating the stream */
+    size_t refs;
+    struct {
+        bool posted;                                        ///< edge job is posted
+        bool busy;                                          ///< head is being operated
+        bool completing;                                    ///< operator calls callback
+        bool again;                                         ///< edge arrived while busy
+        srb_t *head;
+        srb_t *tail;
+    } op[SRB_OP_MAX];
+};
+
+/* drop reference, called with mutex locked which is unlocked then */
+static
+void tcp_stream_unref(tcp_stream_t *stream) {
+    bool last = --stream->refs == 0;
+
+    pthread_mutex_unlock(&stream->mutex);
+
+    if (!last) return;
+
+    pthread_mutex_destroy(&stream->mutex);
+    deallocate(stream);
+}
+
+/* operate queued buffers while the socket is ready */
+static
+void tcp_stream_operate(tcp_stream_t *stream, srb_operation_t op) {
+    srb_t *srb;
+    int err;
+
+    pthread_mutex_lock(&stream->mutex);
+
+    if (stream->op[op].busy) {
+        stream->op[op].again = true;
+        pthread_mutex_unlock(&stream->mutex);
+        return;
+    }
+
+    ++stream->refs;
+
+    while ((srb = stream->op[op].head) &&
+           !stream->op[op].busy && !stream->closing) {
+        stream->op[op].busy = true;
+        stream->op[op].again = false;
+        pthread_mutex_unlock(&stream->mutex);
+
+        err = tcp_send_recv_step(stream->skt, srb);
+
+        pthread_mutex_lock(&stream->mutex);
+        stream->op[op].busy = false;
+
+        if (err < 0) {
+            if (stream->closing) err = ECANCELED;
+            else if (stream->op[op].again) continue;
+            else break;
         }
+
+        stream->op[op].head = srb->next;
+        if (!srb->next) stream->op[op].tail = NULL;
+
+        stream->op[op].completing = true;
+        pthread_mutex_unlock(&stream->mutex);
+        tcp_send_recv_done(stream->skt, srb, err);
+        pthread_mutex_lock(&stream->mutex);
+        stream->op[op].completing = false;
     }
+
+    tcp_stream_unref(stream);
+}
+
+static
+void tcp_stream_job(int fd, io_svc_op_t op, void *ctx) {
+    tcp_stream_operate(ctx, op == IO_SVC_OP_READ ? SRB_OP_RECV : SRB_OP_SEND);
+}
+
+/* Queue buffer and operate it right away if the socket is ready.
+ * Buffer queued while callback of the operation is called is left for
+ * the operator, so that callbacks queueing next buffers do not recurse.
+ */
+static
+void tcp_stream_push(tcp_stream_t *stream, srb_t *srb) {
+    srb_operation_t op = srb->operation.op;
+    bool operate;
+
+    pthread_mutex_lock(&stream->mutex);
+
+    if (!stream->closing && !stream->op[op].posted)
+        stream->op[op].posted =
+            io_service_post_job_edge(stream->iosvc, stream->skt,
+                                     NET_OPERATIONS[op].iosvc_op,
+                                     tcp_stream_job, stream);
+
+    /* nothing would operate the buffer */
+    if (!stream->op[op].posted) {
+        pthread_mutex_unlock(&stream->mutex);
+        tcp_send_recv_done(stream->skt, srb, ECANCELED);
+        return;
+    }
+
+    srb->next = NULL;
+    if (stream->op[op].tail) stream->op[op].tail->next = srb;
+    else stream->op[op].head = srb;
+    stream->op[op].tail = srb;
+
+    operate = !stream->op[op].completing;
+
+    pthread_mutex_unlock(&stream->mutex);
+
+    if (operate) tcp_stream_operate(stream, op);
+}
+
+tcp_stream_t *tcp_stream_init(io_service_t *iosvc, int skt) {
+    tcp_stream_t *stream;
+
+    /* completion based backend operates buffers on its own */
+    if (!iosvc || skt < 0 ||
+        io_service_backend(iosvc) != IO_SVC_BACKEND_EPOLL)
+        return NULL;
+
+    stream = allocate(sizeof(tcp_stream_t));
+    if (!stream) return NULL;
+
+    memset(stream, 0, sizeof(*stream));
+    stream->iosvc = iosvc;
+    stream->skt = skt;
+    stream->refs = 1;
+    pthread_mutex_init(&stream->mutex, NULL);
+
+    return stream;
+}
+
+void tcp_stream_deinit(tcp_stream_t *stream) {
+    srb_t *cancelled = NULL, *srb;
+    srb_operation_t op;
+    bool posted[SRB_OP_MAX];
+
+    if (!stream) return;
+
+    pthread_mutex_lock(&stream->mutex);
+
+    stream->closing = true;
+
+    for (op = 0; op < SRB_OP_MAX; ++op) {
+        posted[op] = stream->op[op].posted;
+        stream->op[op].posted = false;
+    }
+
+    pthread_mutex_unlock(&stream->mutex);
+
+    /* removal waits for the job being dispatched by another runner,
+     * which locks the mutex, so it is not held here
+     */
+    for (op = 0; op < SRB_OP_MAX; ++op)
+        if (posted[op])
+            io_service_remove_job(stream->iosvc, stream->skt,
+                                  NET_OPERATIONS[op].iosvc_op,
+                                  tcp_stream_job, stream);
+
+    pthread_mutex_lock(&stream->mutex);
+
+    for (op = 0; op < SRB_OP_MAX; ++op) {
+        /* buffer being operated is completed by its operator */
+        srb = stream->op[op].head;
+        if (srb && stream->op[op].busy) {
+            stream->op[op].tail = srb;
+            srb = srb->next;
+            stream->op[op].tail->next = NULL;
+        } else
+            stream->op[op].head = stream->op[op].tail = NULL;
+
+        while (srb) {
+            srb_t *next = srb->next;
+
+            srb->next = cancelled;
+            cancelled = srb;
+            srb = next;
+        }
+    }
+
+    pthread_mutex_unlock(&stream->mutex);
+
+    for (; cancelled; cancelled = srb) {
+        srb = cancelled->next;
+        tcp_send_recv_done(stream->skt, cancelled, ECANCELED);
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    tcp_stream_unref(stream);
 }
 
 static
@@ -156,13 +468,15 @@ void udp_send_async_tpl(int fd, io_svc_op_t op_, void *ctx) {
                            MSG_NOSIGNAL | MSG_DONTWAIT);
 
     if (bytes_op_cur < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-            io_service_post_job(iosvc,
-                                fd,
-                                io_svc_op,
-                                true,
-                                udp_send_async_tpl,
-                                srb);
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!io_service_post_job(iosvc,
+                                     fd,
+                                     io_svc_op,
+                                     true,
+                                     udp_send_async_tpl,
+                                     srb))
+                udp_send_complete(fd, io_svc_op, -ECANCELED, srb);
+        }
         else {
             if (srb->cb)
                 (*srb->cb)(srb->aux.dst.ep, errno, bytes_op, more_bytes, buffer, srb->ctx);
@@ -172,13 +486,15 @@ void udp_send_async_tpl(int fd, io_svc_op_t op_, void *ctx) {
     else {
         bytes_op += bytes_op_cur;
         srb->bytes_operated = bytes_op;
-        if (bytes_op < buffer_size(buffer))
-            io_service_post_job(iosvc,
-                                fd,
-                                io_svc_op,
-                                true,
-                                udp_send_async_tpl,
-                                srb);
+        if (bytes_op < buffer_size(buffer)) {
+            if (!io_service_post_job(iosvc,
+                                     fd,
+                                     io_svc_op,
+                                     true,
+                                     udp_send_async_tpl,
+                                     srb))
+                udp_send_complete(fd, io_svc_op, -ECANCELED, srb);
+        }
         else {
             assert(0 == ioctl(fd, NET_OPERATIONS[op].ioctl_request, &more_bytes));
             if (srb->cb)
@@ -319,12 +635,19 @@ void tcp_send_recv_async(srb_t *srb) {
 
     srb->bytes_operated = 0;
 
-    io_service_post_job(srb->iosvc,
-                        ep_skt_ptr->skt,
-                        NET_OPERATIONS[srb->operation.op].iosvc_op,
-                        true,
-                        tcp_send_recv_async_tpl,
-                        srb);
+    if (tcp_send_recv_submit(srb, ep_skt_ptr->skt)) return;
+
+    if (srb->stream) {
+        tcp_stream_push(srb->stream, srb);
+        return;
+    }
+
+    if (!io_service_post_job_edge(srb->iosvc,
+                                  ep_skt_ptr->skt,
+                                  NET_OPERATIONS[srb->operation.op].iosvc_op,
+                                  tcp_send_recv_async_tpl,
+                                  srb))
+        tcp_send_recv_done(ep_skt_ptr->skt, srb, ECANCELED);
 }
 
 static
@@ -405,12 +728,18 @@ void udp_send_async(srb_t *srb) {
 
     srb->bytes_operated = 0;
 
-    io_service_post_job(srb->iosvc,
-                        srb->aux.dst.skt,
-                        NET_OPERATIONS[srb->operation.op].iosvc_op,
-                        true,
-                        udp_send_async_tpl,
-                        srb);
+    if (io_service_submit_msg(srb->iosvc, srb->aux.dst.skt,
+                              IO_SVC_OP_WRITE, &srb->mhdr, MSG_NOSIGNAL,
+                              udp_send_complete, srb))
+        return;
+
+    if (!io_service_post_job(srb->iosvc,
+                             srb->aux.dst.skt,
+                             NET_OPERATIONS[srb->operation.op].iosvc_op,
+                             true,
+                             udp_send_async_tpl,
+                             srb))
+        udp_send_complete(srb->aux.dst.skt, IO_SVC_OP_WRITE, -ECANCELED, srb);
 }
 
 static
@@ -505,12 +834,18 @@ void udp_recv_async(srb_t *srb) {
 
     srb->bytes_operated = 0;
 
-    io_service_post_job(srb->iosvc,
-                        srb->aux.src.skt,
-                        NET_OPERATIONS[srb->operation.op].iosvc_op,
-                        true,
-                        udp_recv_async_tpl,
-                        srb);
+    if (io_service_post_job(srb->iosvc,
+                            srb->aux.src.skt,
+                            NET_OPERATIONS[srb->operation.op].iosvc_op,
+                            true,
+                            udp_recv_async_tpl,
+                            srb))
+        return;
+
+    if (srb->cb)
+        (*srb->cb)(srb->aux.src.ep, ECANCELED, 0, 0, buffer, srb->ctx);
+
+    deallocate(srb);
 }
 
 void srb_operate(srb_t *srb) {
@@ -525,3 +860,17 @@ void srb_operate(srb_t *srb) {
 
     (*op)(srb);
 }
+
+void network_busy_poll(io_service_t *iosvc, int skt) {
+    io_service_params_t params;
+    int usec;
+
+    if (!iosvc || skt < 0) return;
+
+    io_service_params(iosvc, &params);
+
+    if (!params.busy_poll_usec) return;
+
+    usec = (int)params.busy_poll_usec;
+    setsockopt(skt, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+}
@@ -17,6 +17,9 @@ typedef struct connection connection_t;
 struct send_recv_buffer;
 typedef struct send_recv_buffer srb_t;
 
+struct tcp_stream;
+typedef struct tcp_stream tcp_stream_t;
+
 /****************** callback types *******************/
 /** callback on connection accept
  * \param [in] ep connected remote endpoint
@@ -87,12 +90,37 @@ struct send_recv_buffer {
     network_send_recv_cb_t cb;
     void *ctx;
 
+    /* stream of the connection for async TCP operation, may be NULL */
+    tcp_stream_t *stream;
+
     /* internal */
     struct msghdr mhdr;
     struct iovec vec;
+    /* next buffer queued to the stream */
+    srb_t *next;
 };
 
 /****************** functions prototypes **********************/
 void srb_operate(srb_t *srb);
+/** Stream of async TCP operations over connected socket
+ * Edge triggered jobs of the stream stay posted until it is deinited,
+ * so that buffers operated one after another cost no registration
+ * changes. Buffers of the same operation are operated in order.
+ * \return \c NULL if backend of the service is not edge triggered one
+ *         or there is no memory. Buffers are operated on their own then.
+ */
+tcp_stream_t *tcp_stream_init(io_service_t *iosvc, int skt);
+/** Remove jobs of the stream, should be called before socket is closed
+ * Buffers queued and not operated yet are completed with \c ECANCELED.
+ * Waits for the job of the stream being dispatched by another thread,
+ * so it should not be called with locks taken by the callbacks.
+ */
+void tcp_stream_deinit(tcp_stream_t *stream);
+/** Let socket busy poll for the service
+ * SO_BUSY_POLL is set to \c busy_poll_usec parameter of the service,
+ * if any. Failure is ignored as the option requires privileges above
+ * system default.
+ */
+void network_busy_poll(io_service_t *iosvc, int skt);
 
 #endif /* _CHATS_NETWORK_COMMON_H_ */
\ No newline at end of file
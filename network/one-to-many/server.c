@@ -23,12 +23,14 @@ struct otm_server_tcp {
     pthread_mutexattr_t mtx_attr;
     pthread_mutex_t mutex;
     io_service_t *master;
+    io_service_group_t *group;
     endpoint_socket_t local;
     list_t *remotes_list;
 };
 
 static
 void close_connection(const connection_t *connection) {
+    tcp_stream_deinit(connection->stream);
     shutdown(connection->ep_skt.skt, SHUT_RDWR);
     close(connection->ep_skt.skt);
 }
@@ -57,6 +59,11 @@ void tcp_acceptor(int fd, io_svc_op_t op, void *ctx) {
 
     connection->ep_skt.skt = afd;
     connection->ep_skt.ep.ep_type = EPT_TCP;
+    connection->iosvc = server->group
+                         ? io_service_group_by_fd(server->group, afd)
+                         : server->master;
+    connection->stream = tcp_stream_init(connection->iosvc, afd);
+    network_busy_poll(connection->iosvc, afd);
     translate_endpoint(&connection->ep_skt.ep);
 
     if (!(*acceptor->connection_cb)(connection,
@@ -94,6 +101,7 @@ otm_server_tcp_t *otm_server_tcp_init(io_service_t *svc,
     pthread_mutex_init(&server->mutex, &server->mtx_attr);
 
     server->master = svc;
+    server->group = NULL;
     server->reuse_addr = reuse_addr;
 
     server->remotes_list = list_init(sizeof(connection_t));
@@ -150,19 +158,42 @@ fail:
     return NULL;
 }
 
+otm_server_tcp_t *otm_server_tcp_init_group(io_service_group_t *grp,
+                                            const char *addr,
+                                            const char *port,
+                                            int connection_backlog,
+                                            int reuse_addr) {
+    otm_server_tcp_t *server;
+
+    server = otm_server_tcp_init(io_service_group_at(grp, 0),
+                                 addr, port, connection_backlog, reuse_addr);
+
+    /* connections are accepted by the first service of the group */
+    if (server) server->group = grp;
+
+    return server;
+}
+
 void otm_server_tcp_deinit(otm_server_tcp_t *server) {
     connection_t *connection;
     list_t *remotes_list;
 
     if (!server) return;
 
-    pthread_mutex_lock(&server->mutex);
-
     remotes_list = server->remotes_list;
-    for (connection = list_first_element(remotes_list);
-         connection;
-         connection = list_remove_next(remotes_list, connection))
-        close_connection(connection);
+
+    /* not under the mutex, see otm_server_tcp_disconnect */
+    for (;;) {
+        pthread_mutex_lock(&server->mutex);
+        connection = list_first_element(remotes_list);
+        pthread_mutex_unlock(&server->mutex);
+
+        if (!connection) break;
+
+        otm_server_tcp_disconnect(server, connection);
+    }
+
+    pthread_mutex_lock(&server->mutex);
 
     shutdown(server->local.skt, SHUT_RDWR);
     close(server->local.skt);
@@ -176,12 +207,17 @@ void otm_server_tcp_deinit(otm_server_tcp_t *server) {
 
 void otm_server_tcp_disconnect(otm_server_tcp_t *server,
                                const connection_t *connection) {
+    connection_t closed;
+
     if (!server || !connection || connection->host != server) return;
 
     pthread_mutex_lock(&server->mutex);
-    close_connection(connection);
+    closed = *connection;
     list_remove_element(server->remotes_list, (void *)connection);
     pthread_mutex_unlock(&server->mutex);
+
+    /* stream waits for callbacks which may lock the server */
+    close_connection(&closed);
 }
 
 void otm_server_tcp_listen_sync(otm_server_tcp_t *server,
@@ -216,12 +252,15 @@ void otm_server_tcp_listen_async(otm_server_tcp_t *server,
     acceptor->connection_cb = cb;
     acceptor->connection_ctx = ctx;
 
-    io_service_post_job(server->master,
-                        server->local.skt,
-                        IO_SVC_OP_READ,
-                        true,
-                        tcp_acceptor,
-                        acceptor);
+    /* acceptor is not called then */
+    if (!io_service_post_job(server->master,
+                             server->local.skt,
+                             IO_SVC_OP_READ,
+                             true,
+                             tcp_acceptor,
+                             acceptor))
+        deallocate(acceptor);
+
     pthread_mutex_unlock(&server->mutex);
 }
 
@@ -255,6 +294,7 @@ void otm_server_tcp_send_sync(otm_server_tcp_t *server,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_SEND;
     srb->iosvc = NULL;
+    srb->stream = NULL;
     srb->aux.src.skt = -1;
     srb->aux.dst = connection->ep_skt;
 
@@ -283,7 +323,8 @@ void otm_server_tcp_send_async(otm_server_tcp_t *server,
     srb->ctx = ctx;
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_SEND;
-    srb->iosvc = server->master;
+    srb->iosvc = connection->iosvc;
+    srb->stream = connection->stream;
     srb->aux.src.skt = -1;
     srb->aux.dst = connection->ep_skt;
 
@@ -314,6 +355,7 @@ void otm_server_tcp_recv_sync(otm_server_tcp_t *server,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_RECV;
     srb->iosvc = NULL;
+    srb->stream = NULL;
     srb->aux.src = connection->ep_skt;
     srb->aux.dst.skt = -1;
 
@@ -343,7 +385,8 @@ void otm_server_tcp_recv_async(otm_server_tcp_t *server,
     srb->ctx = ctx;
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_RECV;
-    srb->iosvc = server->master;
+    srb->iosvc = connection->iosvc;
+    srb->stream = connection->stream;
     srb->aux.src = connection->ep_skt;
     srb->aux.dst.skt = -1;
 
@@ -4,6 +4,7 @@
 # include "network.h"
 # include "endpoint.h"
 # include "io-service.h"
+# include "io-service-group.h"
 # include "memory.h"
 
 # define DEFAULT_CONNECTION_BACKLOG 50
@@ -16,6 +17,14 @@ otm_server_tcp_t *otm_server_tcp_init(io_service_t *svc,
                                       const char *addr, const char *port,
                                       int connection_backlog,
                                       int reuse_addr);
+/** Server spreading accepted connections over services of the group
+ * Every connection stays bound to the service it was given.
+ */
+otm_server_tcp_t *otm_server_tcp_init_group(io_service_group_t *grp,
+                                            const char *addr,
+                                            const char *port,
+                                            int connection_backlog,
+                                            int reuse_addr);
 void otm_server_tcp_deinit(otm_server_tcp_t *server);
 void otm_server_tcp_disconnect(otm_server_tcp_t *server,
                                const connection_t *connection);
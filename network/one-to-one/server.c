@@ -38,6 +38,7 @@ void oto_tcp_acceptor(int fd, io_svc_op_t op, void *ctx) {
     pthread_mutex_lock(&server->mutex);
 
     server->remote.host = server;
+    server->remote.iosvc = server->master;
 
     dest_addr = (struct sockaddr *)&server->remote.ep_skt.ep.addr;
     len = sizeof(server->remote.ep_skt.ep.addr);
@@ -48,11 +49,15 @@ void oto_tcp_acceptor(int fd, io_svc_op_t op, void *ctx) {
     server->connected = true;
     server->remote.ep_skt.ep.ep_type = EPT_TCP;
     server->remote.ep_skt.skt = afd;
+    server->remote.stream = tcp_stream_init(server->master, afd);
+    network_busy_poll(server->master, afd);
     translate_endpoint(&server->remote.ep_skt.ep);
 
     if (!(*acceptor->connection_cb)(&server->remote,
                                     errno,
                                     acceptor->connection_ctx)) {
+        tcp_stream_deinit(server->remote.stream);
+        server->remote.stream = NULL;
         shutdown(server->remote.ep_skt.skt, SHUT_RDWR);
         close(server->remote.ep_skt.skt);
         server->connected = false;
@@ -138,10 +143,12 @@ fail:
 void oto_server_tcp_deinit(oto_server_tcp_t *server) {
     if (!server) return;
 
-    pthread_mutex_lock(&server->mutex);
+    /* not under the mutex, see oto_server_tcp_disconnect */
     if (server->connected)
         oto_server_tcp_disconnect(server);
 
+    pthread_mutex_lock(&server->mutex);
+
     shutdown(server->local.skt, SHUT_RDWR);
     close(server->local.skt);
 
@@ -153,14 +160,24 @@ void oto_server_tcp_deinit(oto_server_tcp_t *server) {
 }
 
 void oto_server_tcp_disconnect(oto_server_tcp_t *server) {
+    tcp_stream_t *stream;
+    int skt;
+
     if (!server) return;
 
     pthread_mutex_lock(&server->mutex);
 
-    shutdown(server->remote.ep_skt.skt, SHUT_RDWR);
-    close(server->remote.ep_skt.skt);
+    stream = server->remote.stream;
+    server->remote.stream = NULL;
+    skt = server->remote.ep_skt.skt;
 
     pthread_mutex_unlock(&server->mutex);
+
+    /* waits for callbacks which may lock the server */
+    tcp_stream_deinit(stream);
+
+    shutdown(skt, SHUT_RDWR);
+    close(skt);
 }
 
 void oto_server_tcp_listen_sync(oto_server_tcp_t *server,
@@ -203,12 +220,15 @@ void oto_server_tcp_listen_async(oto_server_tcp_t *server,
     acceptor->connection_cb = cb;
     acceptor->connection_ctx = ctx;
 
-    io_service_post_job(server->master,
-                        server->local.skt,
-                        IO_SVC_OP_READ,
-                        true,
-                        oto_tcp_acceptor,
-                        acceptor);
+    /* acceptor is not called then */
+    if (!io_service_post_job(server->master,
+                             server->local.skt,
+                             IO_SVC_OP_READ,
+                             true,
+                             oto_tcp_acceptor,
+                             acceptor))
+        deallocate(acceptor);
+
     pthread_mutex_unlock(&server->mutex);
 }
 
@@ -251,6 +271,7 @@ void oto_server_tcp_send_sync(oto_server_tcp_t *server,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_SEND;
     srb->iosvc = NULL;
+    srb->stream = NULL;
     srb->aux.src.skt = -1;
     srb->aux.dst = server->remote.ep_skt;
 
@@ -277,6 +298,7 @@ void oto_server_tcp_send_async(oto_server_tcp_t *server,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_SEND;
     srb->iosvc = server->master;
+    srb->stream = server->remote.stream;
     srb->aux.src.skt = -1;
     srb->aux.dst = server->remote.ep_skt;
 
@@ -303,6 +325,7 @@ void oto_server_tcp_recv_sync(oto_server_tcp_t *server,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_RECV;
     srb->iosvc = NULL;
+    srb->stream = NULL;
     srb->aux.src = server->remote.ep_skt;
     srb->aux.dst.skt = -1;
 
@@ -329,6 +352,7 @@ void oto_server_tcp_recv_async(oto_server_tcp_t *server,
     srb->operation.type = EPT_TCP;
     srb->operation.op = SRB_OP_RECV;
     srb->iosvc = server->master;
+    srb->stream = server->remote.stream;
     srb->aux.src = server->remote.ep_skt;
     srb->aux.dst.skt = -1;
 
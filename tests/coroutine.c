@@ -0,0 +1,189 @@
+/* signal.h defines stack_t which clashes with the one of common */
+#define stack_t sys_stack_t
+#include <signal.h>
+#include <sys/wait.h>
+#undef stack_t
+
+#include "coroutine.h"
+#include "io-service.h"
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#define THREAD_COUNT 2
+#define MESSAGE_COUNT 5
+#define SLEEP_NSEC 100000000ULL
+/* overflowing coroutine uses few times its stack */
+#define SMALL_STACK_SIZE 4096
+#define OVERFLOW_DEPTH 64
+
+static io_service_t *iosvc;
+static int fds[2];
+static bool ok = true;
+
+static void nothing(int fd, io_svc_op_t op, void *ctx) {
+}
+
+static void writer(void *ctx) {
+    char c;
+
+    for (c = '0'; c < '0' + MESSAGE_COUNT; ++c) {
+        if (!co_sleep(SLEEP_NSEC)) {
+            fprintf(stdout, "Can't sleep\n");
+            ok = false;
+        }
+
+        while (write(fds[1], &c, 1) < 0 && errno == EAGAIN)
+            co_await_write(fds[1]);
+
+        fprintf(stdout, "Sent: %c\n", c);
+    }
+
+    close(fds[1]);
+}
+
+static void reader(void *ctx) {
+    char c;
+    ssize_t r;
+    size_t received = 0;
+
+    /* write end is never readable, the slot is taken by the other job */
+    io_service_post_job(iosvc, fds[1], IO_SVC_OP_READ, true, nothing, NULL);
+
+    if (co_await_read(fds[1])) {
+        fprintf(stdout, "Parked on fd with the job posted already\n");
+        ok = false;
+    }
+
+    io_service_remove_job(iosvc, fds[1], IO_SVC_OP_READ, nothing, NULL);
+
+    for (;;) {
+        co_await_read(fds[0]);
+
+        r = read(fds[0], &c, 1);
+        if (r < 0 && errno == EAGAIN) continue;
+        if (r <= 0) break;
+
+        fprintf(stdout, "Received: %c\n", c);
+
+        if (c != '0' + received) {
+            fprintf(stdout, "Expected: %c\n", (char)('0' + received));
+            ok = false;
+        }
+
+        ++received;
+    }
+
+    if (r < 0) {
+        fprintf(stdout, "Can't read: %s\n", strerror(errno));
+        ok = false;
+    }
+
+    if (received != MESSAGE_COUNT) {
+        fprintf(stdout, "Received %zu of %d\n", received, MESSAGE_COUNT);
+        ok = false;
+    }
+
+    close(fds[0]);
+    io_service_stop(iosvc, true);
+}
+
+static int overflow_fds[2];
+
+static size_t recurse(size_t depth) {
+    volatile char frame[256];
+
+    frame[0] = (char)depth;
+
+    /* the stack is overflown without a fault */
+    if (depth == OVERFLOW_DEPTH) {
+        write(overflow_fds[1], "x", 1);
+        return frame[0];
+    }
+
+    return recurse(depth + 1) + frame[0];
+}
+
+static void overflow(void *ctx) {
+    recurse(0);
+    io_service_stop(iosvc, false);
+}
+
+/* overflow should hit the guard page, not the heap */
+static bool stack_guarded(void) {
+    int status;
+    char c;
+    pid_t pid;
+
+    if (pipe(overflow_fds)) return false;
+
+    pid = fork();
+    if (pid < 0) return false;
+
+    if (!pid) {
+        /* heap below the stack for overflow to run into */
+        allocate(OVERFLOW_DEPTH * 1024);
+
+        iosvc = io_service_init();
+        co_spawn(iosvc, overflow, NULL, SMALL_STACK_SIZE);
+        io_service_run(iosvc);
+        _exit(0);
+    }
+
+    close(overflow_fds[1]);
+
+    if (waitpid(pid, &status, 0) != pid) return false;
+
+    if (read(overflow_fds[0], &c, 1) > 0 ||
+        !WIFSIGNALED(status) || WTERMSIG(status) != SIGSEGV) {
+        fprintf(stdout, "Stack overflow is not caught\n");
+        close(overflow_fds[0]);
+        return false;
+    }
+
+    close(overflow_fds[0]);
+    return true;
+}
+
+static void *run(void *ctx) {
+    io_service_run(iosvc);
+    return NULL;
+}
+
+int main(void) {
+    pthread_t threads[THREAD_COUNT];
+    size_t idx;
+
+    iosvc = io_service_init();
+
+    if (pipe(fds)) return 1;
+
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    if (!co_spawn(iosvc, reader, NULL, 0) ||
+        !co_spawn(iosvc, writer, NULL, 0)) {
+        fprintf(stdout, "Can't spawn coroutines\n");
+        return 1;
+    }
+
+    for (idx = 0; idx < THREAD_COUNT; ++idx)
+        pthread_create(&threads[idx], NULL, run, NULL);
+
+    for (idx = 0; idx < THREAD_COUNT; ++idx)
+        pthread_join(threads[idx], NULL);
+
+    io_service_deinit(iosvc);
+
+    if (!stack_guarded()) ok = false;
+
+    fprintf(stdout, "%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include "io-service-group.h"
+#include "timer.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define SERVICE_COUNT 4
+#define TICKS 3
+
+typedef struct {
+    tmr_t *timer;
+    io_service_t *iosvc;
+    pthread_t thread;
+    bool thread_set;
+    bool wrong_thread;
+    int ticks;
+} timer_context;
+
+static io_service_group_t *grp;
+static timer_context timers[SERVICE_COUNT];
+static atomic_int finished;
+
+static void tick(void *ctx_) {
+    timer_context *ctx = ctx_;
+
+    if (!ctx->thread_set) {
+        ctx->thread = pthread_self();
+        ctx->thread_set = true;
+    }
+    else if (!pthread_equal(ctx->thread, pthread_self()))
+        ctx->wrong_thread = true;
+
+    if (++ctx->ticks == TICKS) {
+        timer_cancel(ctx->timer);
+
+        if (atomic_fetch_add(&finished, 1) + 1 == SERVICE_COUNT)
+            io_service_group_stop(grp, false);
+    }
+}
+
+static atomic_bool stopped_returned;
+
+static void never(int fd, io_svc_op_t op, void *ctx) {
+}
+
+static void *stopped_run(void *ctx) {
+    io_service_group_run(ctx);
+    atomic_store(&stopped_returned, true);
+    return NULL;
+}
+
+/* group stopped before its threads enter the services should return
+ * although every service has a job registered
+ */
+static bool stopped_before_run(void) {
+    io_service_group_t *stopped;
+    pthread_t thread;
+    int fds[2];
+    size_t idx;
+    bool returned;
+
+    stopped = io_service_group_init(SERVICE_COUNT, NULL);
+    if (!stopped || pipe(fds)) return false;
+
+    for (idx = 0; idx < SERVICE_COUNT; ++idx)
+        io_service_post_job(io_service_group_at(stopped, idx), fds[0],
+                            IO_SVC_OP_READ, true, never, NULL);
+
+    io_service_group_stop(stopped, false);
+
+    pthread_create(&thread, NULL, stopped_run, stopped);
+
+    for (idx = 0; idx < 100 && !atomic_load(&stopped_returned); ++idx)
+        usleep(10000);
+
+    returned = atomic_load(&stopped_returned);
+    if (!returned) {
+        fprintf(stdout, "FAILED: stopped group keeps running\n");
+        return false;
+    }
+
+    pthread_join(thread, NULL);
+    io_service_group_deinit(stopped);
+    close(fds[0]);
+    close(fds[1]);
+
+    return true;
+}
+
+int main(void) {
+    size_t idx, other;
+    bool ok = true;
+
+    grp = io_service_group_init(SERVICE_COUNT, NULL);
+
+    if (!grp || io_service_group_size(grp) != SERVICE_COUNT) {
+        fprintf(stdout, "FAILED: init\n");
+        return 1;
+    }
+
+    for (idx = 0; idx < SERVICE_COUNT; ++idx) {
+        timers[idx].timer = timer_init_group(grp);
+        timers[idx].iosvc = io_service_group_at(grp, idx);
+        timer_set_periodic(timers[idx].timer, 0, 100000000, tick, timers + idx);
+    }
+
+    if (!io_service_group_run(grp)) {
+        fprintf(stdout, "FAILED: run\n");
+        return 1;
+    }
+
+    for (idx = 0; idx < SERVICE_COUNT; ++idx) {
+        if (timers[idx].wrong_thread || timers[idx].ticks != TICKS) ok = false;
+
+        /* round-robin gives every timer its own service and thread */
+        for (other = 0; other < idx; ++other)
+            if (pthread_equal(timers[idx].thread, timers[other].thread))
+                ok = false;
+    }
+
+    if (io_service_group_by_fd(grp, 5) != io_service_group_by_fd(grp, 5))
+        ok = false;
+
+    if (!stopped_before_run()) ok = false;
+
+    for (idx = 0; idx < SERVICE_COUNT; ++idx)
+        timer_deinit(timers[idx].timer);
+
+    io_service_group_deinit(grp);
+
+    fprintf(stdout, ok ? "OK\n" : "FAILED\n");
+
+    return ok ? 0 : 1;
+}
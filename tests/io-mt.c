@@ -0,0 +1,227 @@
+#include "io-service.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#define THREAD_COUNT 4
+#define PIPE_COUNT 16
+#define BYTES_PER_PIPE 1000
+
+typedef struct {
+    int fd[2];
+    atomic_int inside;
+    size_t received;
+    bool overlapped;
+} pipe_context;
+
+static io_service_t *iosvc;
+static pipe_context pipes[PIPE_COUNT];
+static atomic_size_t total;
+
+static void reader(int fd, io_svc_op_t op, void *ctx_) {
+    pipe_context *ctx = ctx_;
+    char buf[64];
+    ssize_t r;
+
+    if (atomic_fetch_add(&ctx->inside, 1)) ctx->overlapped = true;
+
+    r = read(fd, buf, sizeof(buf));
+    if (r > 0) {
+        ctx->received += r;
+        if (atomic_fetch_add(&total, r) + r == PIPE_COUNT * BYTES_PER_PIPE)
+            io_service_stop(iosvc, false);
+    }
+
+    atomic_fetch_sub(&ctx->inside, 1);
+
+    io_service_post_job(iosvc, fd, IO_SVC_OP_READ, true, reader, ctx);
+}
+
+static void *runner(void *ctx) {
+    io_service_run(iosvc);
+    return NULL;
+}
+
+static void *writer(void *ctx) {
+    size_t idx, p;
+
+    for (idx = 0; idx < BYTES_PER_PIPE; ++idx)
+        for (p = 0; p < PIPE_COUNT; ++p)
+            write(pipes[p].fd[1], "x", 1);
+
+    return NULL;
+}
+
+static atomic_bool reused_fired;
+
+static void idle_reader(int fd, io_svc_op_t op, void *ctx) {
+}
+
+static void reused_reader(int fd, io_svc_op_t op, void *ctx) {
+    atomic_store(&reused_fired, true);
+    io_service_stop(iosvc, false);
+}
+
+/* job is removed, its fd closed and reopened with the same number.
+ * The job posted for the new fd should fire.
+ */
+static bool fd_reuse(const io_service_params_t *params) {
+    pthread_t thread;
+    int sp[2], old_fd;
+    size_t idx;
+
+    iosvc = io_service_init_params(params);
+    if (!iosvc) return false;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+    old_fd = sp[0];
+
+    io_service_post_job(iosvc, sp[0], IO_SVC_OP_READ, true,
+                        idle_reader, NULL);
+
+    pthread_create(&thread, NULL, runner, NULL);
+
+    /* let the runner register the fd */
+    usleep(100000);
+
+    io_service_remove_job(iosvc, sp[0], IO_SVC_OP_READ, idle_reader, NULL);
+    close(sp[0]);
+    close(sp[1]);
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+    if (sp[0] != old_fd)
+        fprintf(stdout, "fd %d is not reused, got %d\n", old_fd, sp[0]);
+
+    io_service_post_job(iosvc, sp[0], IO_SVC_OP_READ, true,
+                        reused_reader, NULL);
+    write(sp[1], "x", 1);
+
+    for (idx = 0; idx < 100 && !atomic_load(&reused_fired); ++idx)
+        usleep(10000);
+
+    if (!atomic_load(&reused_fired)) io_service_stop(iosvc, false);
+
+    pthread_join(thread, NULL);
+    io_service_deinit(iosvc);
+
+    close(sp[0]);
+    close(sp[1]);
+
+    if (!atomic_load(&reused_fired))
+        fprintf(stdout, "job for reused fd %d did not fire\n", old_fd);
+
+    return atomic_load(&reused_fired);
+}
+
+static atomic_bool slow_started, slow_finished;
+
+static void slow_reader(int fd, io_svc_op_t op, void *ctx) {
+    char c;
+
+    atomic_store(&slow_started, true);
+    read(fd, &c, 1);
+    usleep(200000);
+    atomic_store(&slow_finished, true);
+}
+
+/* job being dispatched by a runner is removed by another thread.
+ * Removal should return only once the job did, so that its context
+ * may be freed right away.
+ */
+static bool remove_running(const io_service_params_t *params) {
+    pthread_t thread;
+    int sp[2];
+    size_t idx;
+    bool finished;
+
+    iosvc = io_service_init_params(params);
+    if (!iosvc) return false;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+
+    io_service_post_job(iosvc, sp[0], IO_SVC_OP_READ, false,
+                        slow_reader, NULL);
+
+    pthread_create(&thread, NULL, runner, NULL);
+    write(sp[1], "x", 1);
+
+    for (idx = 0; idx < 100 && !atomic_load(&slow_started); ++idx)
+        usleep(10000);
+
+    io_service_remove_job(iosvc, sp[0], IO_SVC_OP_READ, slow_reader, NULL);
+    finished = atomic_load(&slow_finished);
+
+    io_service_stop(iosvc, false);
+    pthread_join(thread, NULL);
+    io_service_deinit(iosvc);
+
+    close(sp[0]);
+    close(sp[1]);
+
+    if (!finished)
+        fprintf(stdout, "job is removed while being dispatched\n");
+
+    return finished;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t threads[THREAD_COUNT], writer_thread;
+    io_service_params_t params;
+    size_t idx;
+    bool ok = true;
+
+    memset(&params, 0, sizeof(params));
+
+    if (argc > 1 && !strcmp(argv[1], "uring"))
+        params.backend = IO_SVC_BACKEND_URING;
+
+    iosvc = io_service_init_params(&params);
+    if (!iosvc) {
+        fprintf(stdout, "Can't init IO service: %s\n", strerror(errno));
+        return 1;
+    }
+
+    for (idx = 0; idx < PIPE_COUNT; ++idx) {
+        pipe(pipes[idx].fd);
+        fcntl(pipes[idx].fd[0], F_SETFL, O_NONBLOCK);
+        io_service_post_job(iosvc, pipes[idx].fd[0], IO_SVC_OP_READ, true,
+                            reader, pipes + idx);
+    }
+
+    for (idx = 0; idx < THREAD_COUNT; ++idx)
+        pthread_create(threads + idx, NULL, runner, NULL);
+
+    pthread_create(&writer_thread, NULL, writer, NULL);
+    pthread_join(writer_thread, NULL);
+
+    for (idx = 0; idx < THREAD_COUNT; ++idx)
+        pthread_join(threads[idx], NULL);
+
+    for (idx = 0; idx < PIPE_COUNT; ++idx) {
+        if (pipes[idx].overlapped || pipes[idx].received != BYTES_PER_PIPE) {
+            fprintf(stdout, "pipe %zu: received %zu, overlapped %d\n",
+                    idx, pipes[idx].received, (int)pipes[idx].overlapped);
+            ok = false;
+        }
+
+        close(pipes[idx].fd[0]);
+        close(pipes[idx].fd[1]);
+    }
+
+    io_service_deinit(iosvc);
+
+    if (!fd_reuse(&params)) ok = false;
+    if (!remove_running(&params)) ok = false;
+
+    fprintf(stdout, "%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
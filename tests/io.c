@@ -41,7 +41,7 @@ static void timer_cb_(void *ctx_) {
 
 static void timer_cb(void *ctx_) {
     context *ctx = ctx_;
-    thread_pool_post_job(ctx->tp, timer_cb_, ctx_);
+    io_service_post_task(ctx->iosvc, timer_cb_, ctx_);
 }
 
 static void input(int fd, io_svc_op_t op, void *ctx_) {
@@ -0,0 +1,140 @@
+#include "io-service.h"
+#include "network.h"
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#define BUFFER_COUNT 64
+#define BUFFER_SIZE 16
+
+static io_service_t *iosvc;
+static tcp_stream_t *stream;
+static buffer_t *buffer;
+static int sp[2];
+static size_t received;
+static bool ok = true;
+
+static void recv_next(void);
+
+static void received_cb(endpoint_t ep, int err,
+                        size_t bytes_operated, size_t has_more_bytes,
+                        buffer_t *b, void *ctx) {
+    if (err || bytes_operated != BUFFER_SIZE) {
+        fprintf(stdout, "buffer %zu: err %d, %zu bytes\n",
+                received, err, bytes_operated);
+        ok = false;
+        io_service_stop(iosvc, false);
+        return;
+    }
+
+    if (++received == BUFFER_COUNT) {
+        io_service_stop(iosvc, false);
+        return;
+    }
+
+    recv_next();
+}
+
+static void recv_next(void) {
+    srb_t *srb = allocate(sizeof(srb_t));
+
+    memset(srb, 0, sizeof(*srb));
+    srb->operation.type = EPT_TCP;
+    srb->operation.op = SRB_OP_RECV;
+    srb->iosvc = iosvc;
+    srb->stream = stream;
+    srb->buffer = buffer;
+    srb->cb = received_cb;
+    srb->aux.src.skt = sp[0];
+    srb->aux.src.ep.ep_type = EPT_TCP;
+    srb->aux.dst.skt = -1;
+
+    srb_operate(srb);
+}
+
+/* buffers arrive one by one so that most receives wait for an edge */
+static void *writer(void *ctx) {
+    char data[BUFFER_SIZE];
+    size_t idx;
+
+    memset(data, 'x', sizeof(data));
+
+    for (idx = 0; idx < BUFFER_COUNT; ++idx) {
+        write(sp[1], data, sizeof(data));
+        usleep(1000);
+    }
+
+    return NULL;
+}
+
+/* receive every buffer with or without stream
+ * \return registration changes it took
+ */
+static unsigned long long run(bool with_stream) {
+    io_service_stats_t stats;
+    pthread_t thread;
+
+    iosvc = io_service_init();
+    if (!iosvc) {
+        fprintf(stdout, "Can't init IO service: %s\n", strerror(errno));
+        ok = false;
+        return 0;
+    }
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+    buffer = buffer_init(BUFFER_SIZE, buffer_policy_no_shrink);
+    stream = with_stream ? tcp_stream_init(iosvc, sp[0]) : NULL;
+    received = 0;
+
+    if (with_stream && !stream) {
+        fprintf(stdout, "Can't init stream\n");
+        ok = false;
+    }
+
+    recv_next();
+
+    pthread_create(&thread, NULL, writer, NULL);
+    io_service_run(iosvc);
+    pthread_join(thread, NULL);
+
+    io_service_stats(iosvc, &stats);
+
+    tcp_stream_deinit(stream);
+    io_service_deinit(iosvc);
+    buffer_deinit(buffer);
+    close(sp[0]);
+    close(sp[1]);
+
+    if (received != BUFFER_COUNT) {
+        fprintf(stdout, "received %zu of %d buffers\n",
+                received, BUFFER_COUNT);
+        ok = false;
+    }
+
+    fprintf(stdout, "%s: %llu registration changes for %d buffers\n",
+            with_stream ? "stream" : "per buffer",
+            stats.ctl_calls, BUFFER_COUNT);
+
+    return stats.ctl_calls;
+}
+
+int main(void) {
+    unsigned long long per_buffer = run(false);
+    unsigned long long streamed = run(true);
+
+    /* the stream registers the socket once */
+    if (streamed > 1 || streamed >= per_buffer) {
+        fprintf(stdout, "stream does not save registration changes\n");
+        ok = false;
+    }
+
+    fprintf(stdout, "%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+#include "io-service.h"
+#include "timer.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define TIMER_COUNT 32
+/* deadlines are a tick apart starting from this one */
+#define FIRST_DEADLINE_NSEC (10 * TIMER_TICK_NSEC)
+/* power of two ticks, rounding is exact then */
+#define SLACK_NSEC (16 * TIMER_TICK_NSEC)
+/* timer armed at the end of a callback that long */
+#define CALLBACK_USEC 200000
+#define LATE_DEADLINE_NSEC 100000000UL
+
+static io_service_t *iosvc;
+static tmr_t *timers[TIMER_COUNT];
+static size_t fired;
+static bool ok = true;
+
+static void tick(void *ctx) {
+    if (++fired == TIMER_COUNT) io_service_stop(iosvc, false);
+}
+
+/* arm every timer and run the service until all of them expire
+ * \return timerfd re-arms it took
+ */
+static unsigned long long run(unsigned long slack) {
+    timer_stats_t stats;
+    uint64_t start, expiry, first = 0, expiries = 0, prev = 0;
+    unsigned long deadline;
+    size_t idx;
+
+    iosvc = io_service_init();
+    if (!iosvc) {
+        fprintf(stdout, "Can't init IO service: %s\n", strerror(errno));
+        ok = false;
+        return 0;
+    }
+
+    fired = 0;
+    start = now_nsec();
+
+    for (idx = 0; idx < TIMER_COUNT; ++idx) {
+        timers[idx] = timer_init(iosvc);
+        deadline = FIRST_DEADLINE_NSEC + idx * TIMER_TICK_NSEC;
+        timer_set_deadline_slack(timers[idx], 0, deadline, 0, slack,
+                                 tick, NULL);
+
+        expiry = timer_expiry(timers[idx]);
+
+        if (expiry < start + deadline ||
+            expiry >= now_nsec() + deadline + slack + TIMER_TICK_NSEC) {
+            fprintf(stdout, "timer %zu expires out of [deadline, "
+                            "deadline + slack]\n", idx);
+            ok = false;
+        }
+
+        /* the wheel counts ticks from the same base for every timer */
+        if (!idx) first = expiry;
+        else if (slack && (expiry - first) % slack) {
+            fprintf(stdout, "timer %zu is not on slack boundary\n", idx);
+            ok = false;
+        }
+
+        if (expiry != prev) ++expiries;
+        prev = expiry;
+    }
+
+    if (slack && expiries > TIMER_COUNT * TIMER_TICK_NSEC / slack + 1) {
+        fprintf(stdout, "%llu distinct expiries for slack of %lu nsec\n",
+                (unsigned long long)expiries, slack);
+        ok = false;
+    }
+
+    io_service_run(iosvc);
+
+    timer_stats(iosvc, &stats);
+
+    if (stats.expired != TIMER_COUNT || stats.armed) {
+        fprintf(stdout, "expired %llu of %d, %zu still armed\n",
+                stats.expired, TIMER_COUNT, stats.armed);
+        ok = false;
+    }
+
+    for (idx = 0; idx < TIMER_COUNT; ++idx) {
+        if (timer_expiry(timers[idx])) ok = false;
+        timer_deinit(timers[idx]);
+    }
+
+    io_service_deinit(iosvc);
+
+    fprintf(stdout, "slack %lu nsec: %llu re-arms, %llu wakeups\n",
+            slack, stats.rearms, stats.wakeups);
+
+    return stats.rearms;
+}
+
+static tmr_t *late_timer;
+static uint64_t late_armed, late_fired;
+
+static void late_tick(void *ctx) {
+    late_fired = now_nsec();
+    io_service_stop(iosvc, false);
+}
+
+/* cached time of the service is as old as the callback is */
+static void long_callback(void *ctx) {
+    usleep(CALLBACK_USEC);
+
+    late_armed = now_nsec();
+    timer_set_deadline(late_timer, 0, LATE_DEADLINE_NSEC, late_tick, NULL);
+}
+
+/* deadline is counted from the moment the timer is armed at */
+static void armed_in_callback(void) {
+    iosvc = io_service_init();
+    if (!iosvc) {
+        fprintf(stdout, "Can't init IO service: %s\n", strerror(errno));
+        ok = false;
+        return;
+    }
+
+    late_timer = timer_init(iosvc);
+    io_service_post_task(iosvc, long_callback, NULL);
+    io_service_run(iosvc);
+
+    if (late_fired < late_armed + LATE_DEADLINE_NSEC) {
+        fprintf(stdout, "timer armed in callback fired after %.1f msec\n",
+                (double)(late_fired - late_armed) / 1000000.0);
+        ok = false;
+    }
+
+    timer_deinit(late_timer);
+    io_service_deinit(iosvc);
+}
+
+int main(void) {
+    unsigned long long exact = run(0);
+    unsigned long long slacked = run(SLACK_NSEC);
+
+    if (slacked >= exact) {
+        fprintf(stdout, "slack does not save re-arms\n");
+        ok = false;
+    }
+
+    armed_in_callback();
+
+    fprintf(stdout, "%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -1,26 +1,203 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "thread-pool.h"
 #include "common.h"
 
 #define THREAD_COUNT 10
 #define JOB_COUNT 1000
+/* every nested job posts two children until this depth is reached */
+#define NESTED_DEPTH 12
+#define NESTED_COUNT ((1UL << (NESTED_DEPTH + 1)) - 1)
+/* batch posted to a pool with ring smaller than the batch */
+#define BATCH_QUEUE_SIZE 4
+#define BATCH_COUNT 16
+/* gated jobs give up waiting after this many polls of a msec */
+#define GATE_POLLS 1000
+
+static tp_group_t *nested_grp;
+static atomic_ulong nested_done;
 
 static void r(void *ctx) {
     fprintf(stdout, "%s: %d\n", __func__, (int)ctx);
 }
 
+/* children go to the worker's own deque, idle workers steal them */
+static void nested(void *ctx) {
+    size_t depth = (size_t)ctx;
+
+    if (depth < NESTED_DEPTH) {
+        tp_group_post_job(nested_grp, nested, (void *)(depth + 1));
+        tp_group_post_job(nested_grp, nested, (void *)(depth + 1));
+    }
+
+    atomic_fetch_add(&nested_done, 1);
+}
+
+static atomic_ulong batch_done;
+
+static void batched(void *ctx) {
+    atomic_fetch_add(&batch_done, 1);
+}
+
+/* poster blocks for free slots, parked workers should be woken first */
+static bool post_batch(void) {
+    thread_pool_params_t params = {
+        .thread_count = 2,
+        .queue_size = BATCH_QUEUE_SIZE,
+        .full_policy = TP_FULL_BLOCK
+    };
+    thread_pool_t *tp = thread_pool_init_params(&params);
+    tp_job_t jobs[BATCH_COUNT];
+    size_t idx, posted;
+
+    for (idx = 0; idx < BATCH_COUNT; ++idx) {
+        jobs[idx].job = batched;
+        jobs[idx].ctx = NULL;
+    }
+
+    /* let the workers park */
+    usleep(100000);
+
+    posted = thread_pool_post_jobs(tp, jobs, BATCH_COUNT);
+    thread_pool_stop(tp, true);
+
+    if (posted != BATCH_COUNT || atomic_load(&batch_done) != BATCH_COUNT) {
+        fprintf(stdout, "Batch: posted %zu, completed %lu of %d\n",
+                posted, atomic_load(&batch_done), BATCH_COUNT);
+        return false;
+    }
+
+    return true;
+}
+
+static atomic_bool gate, gated_started;
+static atomic_int then_calls;
+static tp_group_t *rejected_grp;
+
+/* keeps the worker busy until the gate is opened */
+static void gated(void *ctx) {
+    size_t idx;
+
+    atomic_store(&gated_started, true);
+
+    for (idx = 0; idx < GATE_POLLS && !atomic_load(&gate); ++idx)
+        usleep(1000);
+}
+
+static void then_job(void *ctx) {
+    atomic_fetch_add(&then_calls, 1);
+    atomic_store(&gate, true);
+}
+
+static void *post_rejected(void *ctx) {
+    return (void *)(uintptr_t)tp_group_post_job(rejected_grp, batched, NULL);
+}
+
+/* Group post blocks for a slot and is rejected by stop. It is the only
+ * pending one, so the group drains with it and continuation fires.
+ */
+static bool group_rejected(void) {
+    thread_pool_params_t params = {
+        .thread_count = 1,
+        .queue_size = 1,
+        .full_policy = TP_FULL_BLOCK
+    };
+    thread_pool_t *tp = thread_pool_init_params(&params);
+    pthread_t poster;
+    void *posted;
+
+    rejected_grp = tp_group_init(tp);
+
+    thread_pool_post_job(tp, gated, NULL);
+    while (!atomic_load(&gated_started)) usleep(1000);
+
+    /* the ring is full then */
+    thread_pool_post_job(tp, gated, NULL);
+
+    pthread_create(&poster, NULL, post_rejected, NULL);
+    while (!tp_group_pending(rejected_grp)) usleep(1000);
+
+    tp_group_then(rejected_grp, then_job, NULL);
+    thread_pool_stop(tp, false);
+
+    pthread_join(poster, &posted);
+    tp_group_wait(rejected_grp);
+    tp_group_deinit(rejected_grp);
+
+    if (posted || atomic_load(&then_calls) != 1) {
+        fprintf(stdout, "Rejected group post: posted %d, "
+                        "continuation called %d times\n",
+                (int)(uintptr_t)posted, atomic_load(&then_calls));
+        return false;
+    }
+
+    return true;
+}
+
+static void after_job(tp_job_function_t job, void *ctx,
+                      unsigned long long nsec, void *hook_ctx) {
+    atomic_ullong *hooked_nsec = hook_ctx;
+
+    atomic_fetch_add(hooked_nsec, nsec);
+}
+
 int main(void) {
-    thread_pool_t *tp = thread_pool_init(THREAD_COUNT);
+    atomic_ullong hooked_nsec = 0;
+    thread_pool_params_t params = {
+        .thread_count = THREAD_COUNT,
+        .timing = true,
+        .after_job = after_job,
+        .hook_ctx = &hooked_nsec
+    };
+    thread_pool_t *tp = thread_pool_init_params(&params);
+    tp_group_t *grp = tp_group_init(tp);
+    thread_pool_stats_t stats;
     size_t idx;
+    bool ok = true;
 
     for (idx = 0; idx < JOB_COUNT; ++idx) {
         fprintf(stderr, "Posting: %lu job\n", idx);
-        thread_pool_post_job(tp, r, (void *)idx);
+        tp_group_post_job(grp, r, (void *)idx);
     }
 
+    tp_group_wait(grp);
+    tp_group_deinit(grp);
+
+    nested_grp = tp_group_init(tp);
+    tp_group_post_job(nested_grp, nested, (void *)0);
+    tp_group_wait(nested_grp);
+    tp_group_deinit(nested_grp);
+
+    if (atomic_load(&nested_done) != NESTED_COUNT) {
+        fprintf(stdout, "Nested: completed %lu of %lu\n",
+                atomic_load(&nested_done), NESTED_COUNT);
+        ok = false;
+    }
+
+    thread_pool_stats(tp, &stats);
+    fprintf(stderr, "Posted: %llu, completed: %llu, max depth: %zu\n",
+            stats.posted, stats.completed, stats.max_depth);
+    fprintf(stderr, "Wait avg: %llu nsec, exec avg: %llu nsec, "
+                    "hooked: %llu nsec\n",
+            stats.wait_nsec.count ? stats.wait_nsec.sum / stats.wait_nsec.count : 0,
+            stats.exec_nsec.count ? stats.exec_nsec.sum / stats.exec_nsec.count : 0,
+            atomic_load(&hooked_nsec));
+    fprintf(stderr, "Busy: %llu nsec, idle: %llu nsec\n",
+            stats.busy_nsec, stats.idle_nsec);
+
+    if (stats.completed != JOB_COUNT + NESTED_COUNT) ok = false;
+
     thread_pool_stop(tp, true);
 
-    return 0;
-}
\ No newline at end of file
+    if (!post_batch()) ok = false;
+    if (!group_rejected()) ok = false;
+
+    fprintf(stdout, "%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
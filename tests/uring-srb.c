@@ -0,0 +1,278 @@
+#include "io-service.h"
+#include "network.h"
+#include "memory.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+/* fits into fixed buffer, received with registered buffers */
+#define SMALL_SIZE 16
+/* above socket buffer, operated with partial completions */
+#define LARGE_SIZE (1024 * 1024)
+#define FIXED_BUFFER_SIZE 64
+/* cancelled requests complete right away */
+#define DEINIT_NSEC 100000000ULL
+
+static io_service_t *iosvc;
+static int sp[2];
+static buffer_t *small_rx, *small_tx, *large_rx, *large_tx, *closed_rx;
+static size_t large_done;
+static bool reset;
+static bool ok = true;
+
+static void fail(const char *what, int err, size_t bytes) {
+    fprintf(stdout, "%s: err %d, %zu bytes\n", what, err, bytes);
+    ok = false;
+    io_service_stop(iosvc, false);
+}
+
+static void operate(int skt, srb_operation_t op, buffer_t *buffer,
+                    network_send_recv_cb_t cb) {
+    srb_t *srb = allocate(sizeof(srb_t));
+
+    memset(srb, 0, sizeof(*srb));
+    srb->operation.type = EPT_TCP;
+    srb->operation.op = op;
+    srb->iosvc = iosvc;
+    srb->buffer = buffer;
+    srb->cb = cb;
+
+    if (op == SRB_OP_SEND) {
+        srb->aux.dst.skt = skt;
+        srb->aux.dst.ep.ep_type = EPT_TCP;
+        srb->aux.src.skt = -1;
+    } else {
+        srb->aux.src.skt = skt;
+        srb->aux.src.ep.ep_type = EPT_TCP;
+        srb->aux.dst.skt = -1;
+    }
+
+    srb_operate(srb);
+}
+
+static void closed_received(endpoint_t ep, int err,
+                            size_t bytes_operated, size_t has_more_bytes,
+                            buffer_t *buffer, void *ctx) {
+    if (err != ECONNRESET || bytes_operated) {
+        fail("receive from closed peer", err, bytes_operated);
+        return;
+    }
+
+    reset = true;
+    io_service_stop(iosvc, false);
+}
+
+/* both sides of the large buffer are done, the peer closes then */
+static void large_finished(void) {
+    if (++large_done < 2) return;
+
+    if (memcmp(buffer_data(large_rx), buffer_data(large_tx), LARGE_SIZE)) {
+        fail("large buffer content", 0, LARGE_SIZE);
+        return;
+    }
+
+    close(sp[1]);
+    sp[1] = -1;
+
+    operate(sp[0], SRB_OP_RECV, closed_rx, closed_received);
+}
+
+static void large_received(endpoint_t ep, int err,
+                           size_t bytes_operated, size_t has_more_bytes,
+                           buffer_t *buffer, void *ctx) {
+    if (err || bytes_operated != LARGE_SIZE)
+        fail("large receive", err, bytes_operated);
+    else
+        large_finished();
+}
+
+static void large_sent(endpoint_t ep, int err,
+                       size_t bytes_operated, size_t has_more_bytes,
+                       buffer_t *buffer, void *ctx) {
+    if (err || bytes_operated != LARGE_SIZE)
+        fail("large send", err, bytes_operated);
+    else
+        large_finished();
+}
+
+static void small_received(endpoint_t ep, int err,
+                           size_t bytes_operated, size_t has_more_bytes,
+                           buffer_t *buffer, void *ctx) {
+    if (err || bytes_operated != SMALL_SIZE ||
+        memcmp(buffer_data(small_rx), buffer_data(small_tx), SMALL_SIZE)) {
+        fail("small receive", err, bytes_operated);
+        return;
+    }
+
+    operate(sp[0], SRB_OP_RECV, large_rx, large_received);
+    operate(sp[1], SRB_OP_SEND, large_tx, large_sent);
+}
+
+static void small_sent(endpoint_t ep, int err,
+                       size_t bytes_operated, size_t has_more_bytes,
+                       buffer_t *buffer, void *ctx) {
+    if (err || bytes_operated != SMALL_SIZE)
+        fail("small send", err, bytes_operated);
+}
+
+static void fill(buffer_t *buffer) {
+    unsigned char *data = buffer_data(buffer);
+    size_t idx;
+
+    for (idx = 0; idx < buffer_size(buffer); ++idx)
+        data[idx] = (unsigned char)(idx * 7 + 1);
+}
+
+/* small and large buffers, then receive from closed peer
+ * \return false if the backend is not available
+ */
+static bool run(io_svc_backend_t backend, const char *name) {
+    io_service_params_t params;
+
+    memset(&params, 0, sizeof(params));
+    params.backend = backend;
+    params.fixed_buffers = 4;
+    params.fixed_buffer_size = FIXED_BUFFER_SIZE;
+
+    iosvc = io_service_init_params(&params);
+    if (!iosvc) {
+        if (errno == ENOSYS || errno == EPERM) {
+            fprintf(stdout, "%s: not available, skipped\n", name);
+            return false;
+        }
+
+        fprintf(stdout, "%s: can't init IO service: %s\n",
+                name, strerror(errno));
+        ok = false;
+        return false;
+    }
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+
+    small_rx = buffer_init(SMALL_SIZE, buffer_policy_no_shrink);
+    small_tx = buffer_init(SMALL_SIZE, buffer_policy_no_shrink);
+    large_rx = buffer_init(LARGE_SIZE, buffer_policy_no_shrink);
+    large_tx = buffer_init(LARGE_SIZE, buffer_policy_no_shrink);
+    closed_rx = buffer_init(SMALL_SIZE, buffer_policy_no_shrink);
+    fill(small_tx);
+    fill(large_tx);
+    large_done = 0;
+    reset = false;
+
+    operate(sp[0], SRB_OP_RECV, small_rx, small_received);
+    operate(sp[1], SRB_OP_SEND, small_tx, small_sent);
+
+    io_service_run(iosvc);
+    io_service_deinit(iosvc);
+
+    if (!reset) {
+        fprintf(stdout, "%s: closed peer is not reported\n", name);
+        ok = false;
+    }
+
+    close(sp[0]);
+    if (sp[1] >= 0) close(sp[1]);
+
+    buffer_deinit(small_rx);
+    buffer_deinit(small_tx);
+    buffer_deinit(large_rx);
+    buffer_deinit(large_tx);
+    buffer_deinit(closed_rx);
+
+    fprintf(stdout, "%s: %s\n", name, reset ? "done" : "failed");
+
+    return true;
+}
+
+static int cancelled_err;
+
+static void cancelled_received(endpoint_t ep, int err,
+                               size_t bytes_operated, size_t has_more_bytes,
+                               buffer_t *buffer, void *ctx) {
+    cancelled_err = err;
+}
+
+/* buffer operated on a stopped service is completed, not lost */
+static void stopped(io_svc_backend_t backend, const char *name) {
+    io_service_params_t params;
+
+    memset(&params, 0, sizeof(params));
+    params.backend = backend;
+
+    iosvc = io_service_init_params(&params);
+    if (!iosvc) return;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+    small_rx = buffer_init(SMALL_SIZE, buffer_policy_no_shrink);
+    cancelled_err = 0;
+
+    io_service_stop(iosvc, false);
+    operate(sp[0], SRB_OP_RECV, small_rx, cancelled_received);
+
+    if (cancelled_err != ECANCELED) {
+        fprintf(stdout, "%s: stopped service completes with %d\n",
+                name, cancelled_err);
+        ok = false;
+    }
+
+    io_service_deinit(iosvc);
+    close(sp[0]);
+    close(sp[1]);
+    buffer_deinit(small_rx);
+}
+
+/* buffer still in kernel at deinit is cancelled and completed */
+static void pending_at_deinit(void) {
+    io_service_params_t params;
+    uint64_t start;
+
+    memset(&params, 0, sizeof(params));
+    params.backend = IO_SVC_BACKEND_URING;
+
+    iosvc = io_service_init_params(&params);
+    if (!iosvc) return;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+    small_rx = buffer_init(SMALL_SIZE, buffer_policy_no_shrink);
+    cancelled_err = 0;
+
+    operate(sp[0], SRB_OP_RECV, small_rx, cancelled_received);
+
+    start = now_nsec();
+    io_service_deinit(iosvc);
+
+    if (cancelled_err != ECANCELED) {
+        fprintf(stdout, "io_uring: pending buffer completes with %d\n",
+                cancelled_err);
+        ok = false;
+    }
+
+    if (now_nsec() - start > DEINIT_NSEC) {
+        fprintf(stdout, "io_uring: deinit took %llu msec\n",
+                (unsigned long long)((now_nsec() - start) / 1000000));
+        ok = false;
+    }
+
+    close(sp[0]);
+    close(sp[1]);
+    buffer_deinit(small_rx);
+}
+
+int main(void) {
+    run(IO_SVC_BACKEND_URING, "io_uring");
+    stopped(IO_SVC_BACKEND_URING, "io_uring");
+    pending_at_deinit();
+
+    /* completion based operations fall back to readiness */
+    run(IO_SVC_BACKEND_EPOLL, "epoll");
+    stopped(IO_SVC_BACKEND_EPOLL, "epoll");
+
+    fprintf(stdout, "%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+#include "wheel.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define NODE_COUNT 2000
+#define ROUNDS 20000
+/* one past the farthest tick the highest level holds */
+#define WHEEL_SPAN (1ULL << (WHEEL_LEVELS * WHEEL_SLOT_BITS))
+
+typedef struct {
+    wheel_node_t node;                                      ///< the first member
+    uint64_t expires;                                       ///< reference, 0 if not armed
+    bool fired;
+} test_node_t;
+
+static test_node_t nodes[NODE_COUNT];
+static wheel_t wheel;
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+static bool ok = true;
+
+static uint64_t rnd(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    return seed;
+}
+
+static int cmp_expires(const void *a_, const void *b_) {
+    const test_node_t *a = *(test_node_t * const *)a_;
+    const test_node_t *b = *(test_node_t * const *)b_;
+
+    return a->expires < b->expires ? -1 : a->expires > b->expires;
+}
+
+static void fail(const char *what, uint64_t tick) {
+    fprintf(stdout, "%s at tick %llu\n", what, (unsigned long long)tick);
+    ok = false;
+}
+
+static void arm(test_node_t *n, uint64_t expires) {
+    wheel_add(&wheel, &n->node, expires);
+    n->expires = expires > wheel.now ? expires : wheel.now + 1;
+    n->fired = false;
+}
+
+static void cancel(test_node_t *n) {
+    wheel_del(&wheel, &n->node);
+    n->expires = 0;
+}
+
+/* advance the wheel and match expired nodes against sorted reference */
+static void advance(uint64_t now) {
+    static test_node_t *expected[NODE_COUNT];
+    static uint64_t order[NODE_COUNT];
+    wheel_node_t expired, *n;
+    test_node_t *tn;
+    size_t idx, count = 0, got = 0;
+    uint64_t next = wheel_next(&wheel), earliest = WHEEL_NEVER;
+
+    for (idx = 0; idx < NODE_COUNT; ++idx) {
+        if (!nodes[idx].expires) continue;
+
+        if (nodes[idx].expires < earliest) earliest = nodes[idx].expires;
+        if (nodes[idx].expires <= now) expected[count++] = nodes + idx;
+    }
+
+    /* the wheel may wake up earlier to cascade, never later */
+    if (next > earliest) fail("next tick is after the earliest expiry", next);
+
+    qsort(expected, count, sizeof(*expected), cmp_expires);
+
+    /* fired nodes are reset, ties may come in any order */
+    for (idx = 0; idx < count; ++idx) order[idx] = expected[idx]->expires;
+
+    wheel_list_init(&expired);
+    wheel_advance(&wheel, now, &expired);
+
+    if (wheel.now != now) fail("wheel is not advanced", now);
+
+    while ((n = wheel_list_pop(&expired))) {
+        tn = (test_node_t *)n;
+
+        if (tn->fired || !tn->expires) fail("node fired twice", now);
+        else if (got >= count || tn->expires != order[got])
+            fail("node fired out of order", tn->expires);
+
+        tn->fired = true;
+        tn->expires = 0;
+        ++got;
+    }
+
+    if (got != count) fail("nodes are lost", now);
+}
+
+/* walk tick by tick the wheel asks for, every node should fire exactly */
+static void run_exact(uint64_t until) {
+    uint64_t next;
+    size_t idx;
+
+    while ((next = wheel_next(&wheel)) <= until) {
+        advance(next);
+
+        for (idx = 0; idx < NODE_COUNT; ++idx)
+            if (nodes[idx].expires && nodes[idx].expires <= wheel.now)
+                fail("node missed its tick", wheel.now);
+    }
+
+    advance(until);
+}
+
+static void reset(void) {
+    size_t idx;
+
+    wheel_init(&wheel, 0);
+
+    for (idx = 0; idx < NODE_COUNT; ++idx) {
+        wheel_node_init(&nodes[idx].node);
+        nodes[idx].expires = 0;
+        nodes[idx].fired = false;
+    }
+}
+
+static bool linked_count(size_t count) {
+    size_t idx, linked = 0;
+
+    for (idx = 0; idx < NODE_COUNT; ++idx)
+        if (nodes[idx].expires) ++linked;
+
+    return linked == count && wheel.count == count;
+}
+
+static void test_cascade(void) {
+    static const uint64_t ticks[] = {
+        1, 63, 64, 65, 127, 128, 4095, 4096, 4097, 4160,
+        262143, 262144, 262145, 266304, WHEEL_SPAN - 1, WHEEL_SPAN
+    };
+    size_t idx, count = sizeof(ticks) / sizeof(ticks[0]);
+
+    reset();
+
+    for (idx = 0; idx < count; ++idx) arm(nodes + idx, ticks[idx]);
+
+    run_exact(WHEEL_SPAN + 1);
+
+    for (idx = 0; idx < count; ++idx)
+        if (!nodes[idx].fired) fail("cascaded node did not fire", ticks[idx]);
+}
+
+static void test_beyond_top(void) {
+    static const uint64_t ticks[] = {
+        WHEEL_SPAN + 1, 2 * WHEEL_SPAN, 3 * WHEEL_SPAN + 5, 5 * WHEEL_SPAN - 1
+    };
+    size_t idx, count = sizeof(ticks) / sizeof(ticks[0]);
+
+    reset();
+
+    /* start off a slot boundary so that parking slot is not the zero one */
+    wheel_init(&wheel, 12345);
+
+    for (idx = 0; idx < count; ++idx) arm(nodes + idx, 12345 + ticks[idx]);
+
+    run_exact(12345 + 5 * WHEEL_SPAN);
+
+    for (idx = 0; idx < count; ++idx)
+        if (!nodes[idx].fired)
+            fail("node beyond the top level did not fire", ticks[idx]);
+}
+
+static void test_rearm_same_slot(void) {
+    reset();
+
+    /* level 0 */
+    arm(nodes + 0, 10);
+    arm(nodes + 1, 10);
+    cancel(nodes + 0);
+    arm(nodes + 0, 10);
+    cancel(nodes + 1);
+
+    /* level 1, re-armed to the same slot after a cascade is pending */
+    arm(nodes + 2, 200);
+    arm(nodes + 3, 200);
+    cancel(nodes + 2);
+    cancel(nodes + 3);
+    arm(nodes + 3, 201);
+
+    /* re-arm of linked node moves it without cancel */
+    arm(nodes + 4, 300);
+    arm(nodes + 4, 300);
+
+    if (!linked_count(3)) fail("cancel left node in the wheel", wheel.now);
+
+    run_exact(100);
+
+    if (!nodes[0].fired || nodes[1].fired) fail("level 0 re-arm", 10);
+
+    /* cancel and re-arm in level 1 slot which holds node 3 */
+    arm(nodes + 1, 228);
+    cancel(nodes + 1);
+    arm(nodes + 1, 228);
+
+    run_exact(1000);
+
+    if (!nodes[1].fired || nodes[2].fired || !nodes[3].fired ||
+        !nodes[4].fired)
+        fail("level 1 re-arm", 1000);
+
+    if (!linked_count(0)) fail("wheel is not empty", wheel.now);
+}
+
+/* random arm, cancel and advance steps checked against the reference */
+static void test_random(void) {
+    size_t round;
+    test_node_t *n;
+    uint64_t r, delta;
+
+    reset();
+
+    for (round = 0; round < ROUNDS; ++round) {
+        r = rnd();
+        n = nodes + (r >> 8) % NODE_COUNT;
+
+        switch (r & 7) {
+            case 0:
+            case 1:
+            case 2:
+                /* spread deltas over every level and beyond the top one */
+                delta = rnd() & ((1ULL << (rnd() % 27)) - 1);
+                arm(n, wheel.now + delta);
+                break;
+
+            case 3:
+                cancel(n);
+                break;
+
+            case 4:
+                /* the same slot again */
+                if (n->expires) {
+                    delta = n->expires;
+                    cancel(n);
+                    arm(n, delta);
+                }
+                break;
+
+            case 5:
+                if (wheel_next(&wheel) != WHEEL_NEVER)
+                    advance(wheel_next(&wheel));
+                break;
+
+            default:
+                advance(wheel.now + (rnd() & ((1ULL << (rnd() % 20)) - 1)));
+                break;
+        }
+
+        if (!ok) return;
+
+        if (!linked_count(wheel.count)) {
+            fail("wheel count differs from reference", wheel.now);
+            return;
+        }
+    }
+
+    run_exact(wheel.now + 5 * WHEEL_SPAN);
+
+    if (!linked_count(0)) fail("wheel is not empty", wheel.now);
+}
+
+int main(void) {
+    test_cascade();
+    test_beyond_top();
+    test_rearm_same_slot();
+    test_random();
+
+    fprintf(stdout, "%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
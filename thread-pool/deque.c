@@ -0,0 +1,163 @@
+#include "deque.h"
+#include "memory.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Implemented after "Correct and Efficient Work-Stealing for Weak Memory
+ * Models" by Le, Pop, Cohen and Zappa Nardelli.
+ */
+
+static
+deque_array_t *deque_array_init(size_t size) {
+    deque_array_t *a = allocate(sizeof(deque_array_t) +
+                                size * sizeof(deque_slot_t));
+
+    if (!a) return NULL;
+
+    a->size = size;
+    a->retired = NULL;
+
+    return a;
+}
+
+static
+void deque_slot_store(deque_array_t *a, long long idx, const deque_job_t *job) {
+    deque_slot_t *slot = a->slot + (idx & (a->size - 1));
+
+    atomic_store_explicit(&slot->job, (uintptr_t)job->job,
+                          memory_order_relaxed);
+    atomic_store_explicit(&slot->ctx, (uintptr_t)job->ctx,
+                          memory_order_relaxed);
+    atomic_store_explicit(&slot->group, (uintptr_t)job->group,
+                          memory_order_relaxed);
+    atomic_store_explicit(&slot->posted, job->posted, memory_order_relaxed);
+}
+
+static
+void deque_slot_load(deque_array_t *a, long long idx, deque_job_t *job) {
+    deque_slot_t *slot = a->slot + (idx & (a->size - 1));
+
+    job->job = (tp_job_function_t)atomic_load_explicit(&slot->job,
+                                                       memory_order_relaxed);
+    job->ctx = (void *)atomic_load_explicit(&slot->ctx, memory_order_relaxed);
+    job->group = (tp_group_t *)atomic_load_explicit(&slot->group,
+                                                    memory_order_relaxed);
+    job->posted = atomic_load_explicit(&slot->posted, memory_order_relaxed);
+}
+
+/* double the array, old one is kept until deque is deinitialized */
+static
+deque_array_t *deque_grow(deque_t *dq, deque_array_t *a,
+                          long long top, long long bottom) {
+    deque_array_t *na = deque_array_init(a->size << 1);
+    deque_job_t job;
+    long long idx;
+
+    if (!na) return NULL;
+
+    for (idx = top; idx < bottom; ++idx) {
+        deque_slot_load(a, idx, &job);
+        deque_slot_store(na, idx, &job);
+    }
+
+    na->retired = a;
+    atomic_store_explicit(&dq->array, na, memory_order_release);
+
+    return na;
+}
+
+bool deque_init(deque_t *dq, size_t size) {
+    size_t sz = 1;
+
+    while (sz < size) sz <<= 1;
+
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+    atomic_init(&dq->array, deque_array_init(sz));
+
+    return atomic_load(&dq->array) != NULL;
+}
+
+void deque_deinit(deque_t *dq) {
+    deque_array_t *a = atomic_load(&dq->array), *retired;
+
+    for (; a; a = retired) {
+        retired = a->retired;
+        deallocate(a);
+    }
+
+    atomic_store(&dq->array, NULL);
+}
+
+bool deque_push(deque_t *dq, const deque_job_t *job) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    deque_array_t *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+
+    if (b - t > (long long)a->size - 1) {
+        a = deque_grow(dq, a, t, b);
+        if (!a) return false;
+    }
+
+    deque_slot_store(a, b, job);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+
+    return true;
+}
+
+bool deque_pop(deque_t *dq, deque_job_t *job) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    deque_array_t *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+    long long t;
+    bool ret = true;
+
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    if (t > b) {
+        /* empty */
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+
+    deque_slot_load(a, b, job);
+
+    if (t == b) {
+        /* the last one, race against thieves */
+        ret = atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                                      memory_order_seq_cst,
+                                                      memory_order_relaxed);
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return ret;
+}
+
+bool deque_steal(deque_t *dq, deque_job_t *job) {
+    long long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    long long b;
+    deque_array_t *a;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+    if (t >= b) return false;
+
+    a = atomic_load_explicit(&dq->array, memory_order_acquire);
+    deque_slot_load(a, t, job);
+
+    return atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed);
+}
+
+size_t deque_size(deque_t *dq) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    return b > t ? (size_t)(b - t) : 0;
+}
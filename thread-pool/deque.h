@@ -0,0 +1,55 @@
+#ifndef _THREAD_POOL_DEQUE_H_
+# define _THREAD_POOL_DEQUE_H_
+
+# include "thread-pool.h"
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+# include <stdatomic.h>
+
+/* Chase-Lev work stealing deque of jobs.
+ * The owner pushes and pops at the bottom, thieves steal from the top.
+ * Slot fields are atomic since thieves read them concurrently with the
+ * owner. The read is validated with CAS of top.
+ */
+
+/** Job as stored in pool queues
+ */
+typedef struct deque_job {
+    tp_job_function_t job;
+    void *ctx;
+    tp_group_t *group;                                      ///< group the job belongs to, if any
+    uint64_t posted;                                        ///< post time if pool timing is on
+} deque_job_t;
+
+typedef struct deque_slot {
+    _Atomic uintptr_t job;
+    _Atomic uintptr_t ctx;
+    _Atomic uintptr_t group;
+    _Atomic uint64_t posted;
+} deque_slot_t;
+
+typedef struct deque_array {
+    size_t size;                                            ///< power of two
+    /* arrays replaced with grow, thieves may still read them */
+    struct deque_array *retired;
+    deque_slot_t slot[];
+} deque_array_t;
+
+typedef struct deque {
+    atomic_llong top;
+    atomic_llong bottom;
+    deque_array_t *_Atomic array;
+} deque_t;
+
+bool deque_init(deque_t *dq, size_t size);
+void deque_deinit(deque_t *dq);
+/* owner only */
+bool deque_push(deque_t *dq, const deque_job_t *job);
+bool deque_pop(deque_t *dq, deque_job_t *job);
+/* any thread */
+bool deque_steal(deque_t *dq, deque_job_t *job);
+size_t deque_size(deque_t *dq);
+
+#endif /* _THREAD_POOL_DEQUE_H_ */
@@ -1,140 +1,1033 @@
+#define _GNU_SOURCE
+
 #include "thread-pool.h"
+#include "deque.h"
 #include "common.h"
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
 #include <pthread.h>
 
-typedef struct job {
-    tp_job_function_t job;
-    void *ctx;
-} job_t;
+/* Work stealing thread pool.
+ * Every worker has its own deque. Jobs posted by a worker go to its own
+ * deque, jobs posted by other threads go to the injection queue. Idle
+ * worker pops its deque first, then takes from the injection queue and
+ * then steals from other workers. Worker with nothing to do parks and a
+ * single one is woken up per posted job.
+ * Injection queue is a ring of preallocated slots so that posting a job
+ * does not touch allocator unless the queue grows.
+ * There is an injection queue per priority lane. Interactive jobs always
+ * go to their ring, worker deques hold background jobs only.
+ * Elastic pool keeps descriptors for max count of workers. Worker is
+ * added when jobs wait for too long and retires after idle timeout.
+ */
+
+#define DEQUE_INITIAL_SIZE 64
+#define GROUP_HELP_WAIT_NSEC 1000000
+#define NUMA_NODE_CPULIST "/sys/devices/system/node/node%u/cpulist"
+
+typedef deque_job_t job_t;
+
+typedef enum worker_state {
+    WORKER_FREE = 0,                                        ///< no thread, descriptor may be used
+    WORKER_RUNNING,
+    WORKER_RETIRING,                                        ///< leaving, not joined yet
+    WORKER_EXITED                                           ///< left, not joined yet
+} worker_state_t;
 
 typedef struct thread_descr {
     pthread_attr_t attr;
     pthread_t id;
+    atomic_int state;
+    thread_pool_t *tp;
+    deque_t deque;
+    unsigned seed;                                          ///< victim selection
+    size_t burst;                                           ///< interactive jobs taken in a row
+    /* written by the worker only */
+    atomic_ullong completed;
+    atomic_ullong busy_nsec;
+    atomic_ullong idle_nsec;
 } thread_descr_t;
 
+typedef struct tp_lane {
+    /* ring is guarded by job_mutex */
+    job_t *ring;
+    size_t ring_size;                                       ///< power of two
+    size_t ring_head;                                       ///< next slot to take
+    size_t ring_tail;                                       ///< next slot to fill
+    atomic_size_t injected;                                 ///< jobs in ring
+    atomic_size_t depth;                                    ///< jobs posted and not taken
+    atomic_ullong posted;
+    atomic_ullong taken;
+    atomic_ullong max_depth;
+    atomic_ullong wait_nsec;
+    atomic_ullong max_wait_nsec;
+} tp_lane_t;
+
 struct thread_pool {
-    list_t *queue;
-    pthread_mutex_t job_mutex;                              ///< queue access mtx
+    tp_lane_t lane[TP_PRIORITY_COUNT];                      ///< injection queues
+    tp_full_policy_t full_policy;
+    size_t full_waiters;                                    ///< posters blocked on full ring
+    size_t interactive_burst;
+    bool timing;
+    bool elastic;
+    size_t min_threads;
+    size_t max_threads;                                     ///< count of descriptors
+    uint64_t grow_wait_nsec;
+    unsigned long idle_timeout_msec;
+    int *cpus;                                              ///< copy of placement parameters
+    size_t cpu_count;
+    unsigned long numa_nodes;
+    pthread_mutex_t job_mutex;                              ///< queue access and parking mtx
     pthread_cond_t job_semaphore;                           ///< thread run semaphore
     pthread_cond_t job_end_semaphore;
-    bool run;                                               ///< should threads run any more
-    bool allow_new_jobs;
-    size_t thread_count;
+    pthread_cond_t job_slot_semaphore;                      ///< ring slot freed
+    atomic_bool run;                                        ///< should threads run any more
+    atomic_bool allow_new_jobs;
+    atomic_size_t queued;                                   ///< jobs posted but not taken yet
+    atomic_size_t sleepers;                                 ///< parked workers
+    atomic_size_t active;                                   ///< running workers
+    atomic_ullong last_take;                                ///< time job was taken last
+    atomic_ullong last_grow;
+    atomic_ullong grows;
+    atomic_ullong shrinks;
+    atomic_ullong max_queued;
+    atomic_histogram_t wait_nsec;
+    atomic_histogram_t exec_nsec;
+    tp_job_hook_t before_job;
+    tp_job_hook_t after_job;
+    void *hook_ctx;
     thread_descr_t *thread_descr;
 };
 
-static void push_job(thread_pool_t *tp, tp_job_function_t job, void *ctx) {
-    job_t *job_el = list_append(tp->queue);
+struct tp_group {
+    thread_pool_t *tp;
+    atomic_size_t pending;                                  ///< jobs posted and not executed
+    pthread_mutex_t mutex;                                  ///< guards drain of pending
+    pthread_cond_t drained;
+    tp_job_function_t then;                                 ///< continuation
+    void *then_ctx;
+};
+
+/* worker the current thread is, if any */
+static _Thread_local thread_descr_t *current_worker = NULL;
 
-    if (!job_el) return;
+static void grow_worker(thread_pool_t *tp);
 
-    job_el->job = job;
-    job_el->ctx = ctx;
+/* account jobs going to lane before they become visible to takers */
+static
+void lane_posted(tp_lane_t *lane, size_t n) {
+    atomic_fetch_add_explicit(&lane->posted, n, memory_order_relaxed);
+    atomic_max(&lane->max_depth, atomic_fetch_add(&lane->depth, n) + n);
 }
 
-static void get_and_pop_job(thread_pool_t *tp, tp_job_function_t *job, void **ctx) {
-    job_t *job_el = list_first_element(tp->queue);
-    if (!job_el) {
-        *job = NULL;
-        *ctx = NULL;
-        return;
+/* revert accounting of jobs which were not posted */
+static
+void lane_unposted(tp_lane_t *lane, size_t n) {
+    atomic_fetch_sub_explicit(&lane->posted, n, memory_order_relaxed);
+    atomic_fetch_sub(&lane->depth, n);
+}
+
+static
+void lane_taken(thread_pool_t *tp, tp_lane_t *lane, const job_t *job) {
+    uint64_t now, wait;
+
+    atomic_fetch_add_explicit(&lane->taken, 1, memory_order_relaxed);
+    atomic_fetch_sub(&lane->depth, 1);
+
+    if (!tp->timing && !tp->elastic) return;
+
+    now = now_nsec();
+    wait = now - job->posted;
+
+    if (tp->timing) {
+        atomic_fetch_add_explicit(&lane->wait_nsec, wait, memory_order_relaxed);
+        atomic_max(&lane->max_wait_nsec, wait);
+        histogram_add(&tp->wait_nsec, wait);
+    }
+
+    if (tp->elastic) {
+        atomic_store_explicit(&tp->last_take, now, memory_order_relaxed);
+
+        if (wait > tp->grow_wait_nsec && !atomic_load(&tp->sleepers))
+            grow_worker(tp);
+    }
+}
+
+/* workers may be stuck in jobs if none of them took a job for long */
+static
+void check_pressure(thread_pool_t *tp, uint64_t now) {
+    uint64_t last_take = atomic_load_explicit(&tp->last_take,
+                                              memory_order_relaxed);
+
+    if (atomic_load(&tp->sleepers)) return;
+
+    if (!atomic_load(&tp->active) ||
+        (now > last_take && now - last_take > tp->grow_wait_nsec))
+        grow_worker(tp);
+}
+
+static
+size_t ring_count(const tp_lane_t *lane) {
+    return lane->ring_tail - lane->ring_head;
+}
+
+/* double the ring keeping order of jobs, called with job_mutex locked */
+static
+bool ring_grow(tp_lane_t *lane) {
+    size_t new_size = lane->ring_size << 1, idx, count = ring_count(lane);
+    job_t *ring = allocate(new_size * sizeof(job_t));
+
+    if (!ring) return false;
+
+    for (idx = 0; idx < count; ++idx)
+        ring[idx] = lane->ring[(lane->ring_head + idx) & (lane->ring_size - 1)];
+
+    deallocate(lane->ring);
+    lane->ring = ring;
+    lane->ring_size = new_size;
+    lane->ring_head = 0;
+    lane->ring_tail = count;
+
+    return true;
+}
+
+/* called with job_mutex locked */
+static bool push_job(thread_pool_t *tp, tp_lane_t *lane, const job_t *job) {
+    while (ring_count(lane) == lane->ring_size) {
+        switch (tp->full_policy) {
+            case TP_FULL_GROW:
+                if (!ring_grow(lane)) return false;
+                break;
+
+            case TP_FULL_BLOCK:
+                ++tp->full_waiters;
+                pthread_cond_wait(&tp->job_slot_semaphore, &tp->job_mutex);
+                --tp->full_waiters;
+
+                if (!atomic_load(&tp->allow_new_jobs)) return false;
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    lane->ring[lane->ring_tail++ & (lane->ring_size - 1)] = *job;
+
+    atomic_fetch_add(&lane->injected, 1);
+
+    return true;
+}
+
+/* called with job_mutex locked */
+static bool get_and_pop_job(thread_pool_t *tp, tp_lane_t *lane, job_t *job) {
+    if (!ring_count(lane)) return false;
+
+    *job = lane->ring[lane->ring_head++ & (lane->ring_size - 1)];
+
+    atomic_fetch_sub(&lane->injected, 1);
+
+    /* slots are freed in any lane, blocked posters recheck their own */
+    if (tp->full_waiters)
+        pthread_cond_broadcast(&tp->job_slot_semaphore);
+
+    return true;
+}
+
+static bool take_injected(thread_pool_t *tp, tp_lane_t *lane, job_t *job) {
+    bool found;
+
+    if (!atomic_load(&lane->injected)) return false;
+
+    pthread_mutex_lock(&tp->job_mutex);
+    found = get_and_pop_job(tp, lane, job);
+    pthread_mutex_unlock(&tp->job_mutex);
+
+    return found;
+}
+
+static bool steal_job(thread_pool_t *tp, thread_descr_t *self, job_t *job) {
+    size_t idx, start, victim;
+
+    /* deques of descriptors without thread are empty */
+    start = (size_t)rand_r(&self->seed) % tp->max_threads;
+
+    for (idx = 0; idx < tp->max_threads; ++idx) {
+        victim = (start + idx) % tp->max_threads;
+
+        if (tp->thread_descr + victim == self) continue;
+
+        if (deque_steal(&tp->thread_descr[victim].deque, job))
+            return true;
+    }
+
+    return false;
+}
+
+/* Interactive jobs go first. With burst limit set worker gives background
+ * job a chance after the limit is hit.
+ */
+static bool take_job(thread_pool_t *tp, thread_descr_t *self, job_t *job) {
+    tp_lane_t *fg = tp->lane + TP_PRIORITY_INTERACTIVE;
+    tp_lane_t *bg = tp->lane + TP_PRIORITY_BACKGROUND;
+    bool skipped = tp->interactive_burst &&
+                   self->burst >= tp->interactive_burst;
+
+    if (!skipped && take_injected(tp, fg, job)) {
+        ++self->burst;
+        lane_taken(tp, fg, job);
+        return true;
+    }
+
+    if (deque_pop(&self->deque, job) ||
+        take_injected(tp, bg, job) ||
+        steal_job(tp, self, job)) {
+        self->burst = 0;
+        lane_taken(tp, bg, job);
+        return true;
+    }
+
+    if (skipped && take_injected(tp, fg, job)) {
+        lane_taken(tp, fg, job);
+        return true;
+    }
+
+    return false;
+}
+
+/* job is taken off the queues. Let stopper know if the queues drained. */
+static void job_taken(thread_pool_t *tp) {
+    if (atomic_fetch_sub(&tp->queued, 1) == 1 &&
+        !atomic_load(&tp->allow_new_jobs)) {
+        pthread_mutex_lock(&tp->job_mutex);
+        pthread_cond_broadcast(&tp->job_end_semaphore);
+        pthread_mutex_unlock(&tp->job_mutex);
+    }
+}
+
+/* Group job is executed or failed to be posted.
+ * Last one drains pending under the mutex so that waiter which observes
+ * zero may destroy the group right away. Continuation fires on the drain
+ * either way, as tp_group_then on a drained group does.
+ */
+static void group_job_done(tp_group_t *grp) {
+    size_t pending = atomic_load(&grp->pending);
+    tp_job_function_t then = NULL;
+    void *then_ctx = NULL;
+
+    while (pending > 1)
+        if (atomic_compare_exchange_weak(&grp->pending, &pending, pending - 1))
+            return;
+
+    pthread_mutex_lock(&grp->mutex);
+
+    if (atomic_fetch_sub(&grp->pending, 1) == 1) {
+        then = grp->then;
+        then_ctx = grp->then_ctx;
+        grp->then = NULL;
+        grp->then_ctx = NULL;
+        pthread_cond_broadcast(&grp->drained);
+    }
+
+    pthread_mutex_unlock(&grp->mutex);
+
+    if (then) (*then)(then_ctx);
+}
+
+static void run_job(thread_pool_t *tp, thread_descr_t *self,
+                    const job_t *job) {
+    uint64_t start = tp->timing ? now_nsec() : 0, nsec = 0;
+
+    if (tp->before_job) (*tp->before_job)(job->job, job->ctx, 0, tp->hook_ctx);
+
+    if (job->job) (*job->job)(job->ctx);
+
+    if (tp->timing) {
+        nsec = now_nsec() - start;
+        histogram_add(&tp->exec_nsec, nsec);
+        atomic_fetch_add_explicit(&self->busy_nsec, nsec, memory_order_relaxed);
     }
 
-    *job = job_el->job;
-    *ctx = job_el->ctx;
+    if (tp->after_job)
+        (*tp->after_job)(job->job, job->ctx, nsec, tp->hook_ctx);
 
-    list_remove_element(tp->queue, job_el);
-    if (!list_size(tp->queue)) pthread_cond_broadcast(&tp->job_end_semaphore);
+    atomic_fetch_add_explicit(&self->completed, 1, memory_order_relaxed);
+
+    if (job->group) group_job_done(job->group);
+}
+
+/* wake up to count parked workers, called with job_mutex locked */
+static void wake_sleepers(thread_pool_t *tp, size_t count) {
+    size_t sleepers = atomic_load(&tp->sleepers);
+
+    if (count > sleepers) count = sleepers;
+
+    for (; count; --count)
+        pthread_cond_signal(&tp->job_semaphore);
 }
 
-static void *worker_tpl(void *_tp) {
-    thread_pool_t *tp = (thread_pool_t *)_tp;
+/* wake up single parked worker if there is any */
+static void wake_worker(thread_pool_t *tp) {
+    if (!atomic_load(&tp->sleepers)) return;
+
+    pthread_mutex_lock(&tp->job_mutex);
+    pthread_cond_signal(&tp->job_semaphore);
+    pthread_mutex_unlock(&tp->job_mutex);
+}
+
+static void *worker_tpl(void *_td) {
+    thread_descr_t *self = (thread_descr_t *)_td;
+    thread_pool_t *tp = self->tp;
     pthread_mutex_t *job_mutex = &tp->job_mutex;
     pthread_cond_t *job_semaphore = &tp->job_semaphore;
-    tp_job_function_t job;
-    void *ctx;
+    job_t job;
+    struct timespec deadline;
+    bool timed_out, retire = false;
+    uint64_t parked = 0;
+
+    current_worker = self;
+
+    while (atomic_load(&tp->run)) {
+        if (take_job(tp, self, &job)) {
+            job_taken(tp);
+            run_job(tp, self, &job);
+            continue;
+        }
+
+        if (tp->timing) parked = now_nsec();
 
-    while (true) {
         pthread_mutex_lock(job_mutex);
-        while (tp->run && tp->allow_new_jobs && (list_size(tp->queue) == 0))
-            pthread_cond_wait(job_semaphore, job_mutex);
 
-        if (!tp->run) break;
-        if (list_size(tp->queue) == 0 && !tp->allow_new_jobs) break;
+        /* posters check sleepers after queued is incremented */
+        atomic_fetch_add(&tp->sleepers, 1);
+
+        timed_out = false;
+
+        if (tp->elastic) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += tp->idle_timeout_msec / 1000;
+            deadline.tv_nsec += (tp->idle_timeout_msec % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_nsec -= 1000000000;
+                ++deadline.tv_sec;
+            }
+        }
+
+        while (atomic_load(&tp->run) && atomic_load(&tp->allow_new_jobs) &&
+               atomic_load(&tp->queued) == 0 && !timed_out) {
+            if (tp->elastic && atomic_load(&tp->active) > tp->min_threads)
+                timed_out = pthread_cond_timedwait(job_semaphore, job_mutex,
+                                                   &deadline) == ETIMEDOUT;
+            else
+                pthread_cond_wait(job_semaphore, job_mutex);
+        }
+
+        atomic_fetch_sub(&tp->sleepers, 1);
+
+        if (atomic_load(&tp->queued) == 0 &&
+            !atomic_load(&tp->allow_new_jobs)) {
+            pthread_mutex_unlock(job_mutex);
+            break;
+        }
+
+        /* own deque is empty as worker parks only after failing to take */
+        retire = timed_out && atomic_load(&tp->queued) == 0 &&
+                 atomic_load(&tp->active) > tp->min_threads;
+
+        if (retire) {
+            atomic_store(&self->state, WORKER_RETIRING);
+            atomic_fetch_sub(&tp->active, 1);
+            atomic_fetch_add(&tp->shrinks, 1);
+        }
 
-        get_and_pop_job(tp, &job, &ctx);
         pthread_mutex_unlock(job_mutex);
 
-        if (job) (*job)(ctx);
+        if (tp->timing)
+            atomic_fetch_add_explicit(&self->idle_nsec, now_nsec() - parked,
+                                      memory_order_relaxed);
+
+        if (retire) break;
     }
 
-    pthread_mutex_unlock(job_mutex);
+    current_worker = NULL;
+
+    if (retire) atomic_store(&self->state, WORKER_EXITED);
+
     return NULL;
 }
 
-thread_pool_t *thread_pool_init(size_t thread_count) {
+/* add CPUs of NUMA node to set, cpulist looks like "0-3,8-11" */
+static
+bool numa_node_cpus(unsigned node, cpu_set_t *set) {
+    char path[64];
+    FILE *f;
+    int first, last, cpu;
+    char sep;
+    bool found = false;
+
+    snprintf(path, sizeof(path), NUMA_NODE_CPULIST, node);
+
+    f = fopen(path, "r");
+    if (!f) return false;
+
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        sep = fgetc(f);
+
+        if (sep == '-') {
+            if (fscanf(f, "%d", &last) != 1) break;
+            sep = fgetc(f);
+        }
+
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, set);
+            found = true;
+        }
+
+        if (sep != ',') break;
+    }
+
+    fclose(f);
+
+    return found;
+}
+
+/* CPUs worker is pinned to as requested by params */
+static
+bool worker_cpus(const thread_pool_t *tp, size_t idx, cpu_set_t *set) {
+    unsigned node;
+    bool found = false;
+
+    CPU_ZERO(set);
+
+    if (tp->cpu_count) {
+        int cpu = tp->cpus[idx % tp->cpu_count];
+
+        if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+
+        CPU_SET(cpu, set);
+        return true;
+    }
+
+    for (node = 0; node < sizeof(tp->numa_nodes) * 8; ++node)
+        if (tp->numa_nodes & (1UL << node))
+            found = numa_node_cpus(node, set) || found;
+
+    return found;
+}
+
+static
+void worker_start(thread_descr_t *td, const cpu_set_t *set) {
+    pthread_attr_init(&td->attr);
+    pthread_attr_setdetachstate(&td->attr, PTHREAD_CREATE_JOINABLE);
+
+    if (set) pthread_attr_setaffinity_np(&td->attr, sizeof(*set), set);
+
+    if (!pthread_create(&td->id, &td->attr, worker_tpl, td) || !set)
+        return;
+
+    /* CPUs may be offline or out of process cpuset, run unpinned */
+    pthread_attr_destroy(&td->attr);
+    worker_start(td, NULL);
+}
+
+/* start worker in free descriptor, called with job_mutex locked */
+static
+void start_worker_at(thread_pool_t *tp, size_t idx) {
+    thread_descr_t *td = tp->thread_descr + idx;
+    cpu_set_t set;
+
+    if (atomic_load(&td->state) == WORKER_EXITED) {
+        pthread_join(td->id, NULL);
+        pthread_attr_destroy(&td->attr);
+    }
+
+    atomic_store(&td->state, WORKER_RUNNING);
+    atomic_fetch_add(&tp->active, 1);
+    worker_start(td, worker_cpus(tp, idx, &set) ? &set : NULL);
+}
+
+static
+bool may_grow(thread_pool_t *tp, uint64_t now) {
+    size_t active = atomic_load(&tp->active);
+
+    return active < tp->max_threads &&
+           (!active ||
+            now - atomic_load(&tp->last_grow) >= tp->grow_wait_nsec);
+}
+
+/* add worker to elastic pool, at most one per grow wait period unless
+ * pool has no workers at all
+ */
+static
+void grow_worker(thread_pool_t *tp) {
+    uint64_t now = now_nsec();
     size_t idx;
-    thread_pool_t *tp = allocate(sizeof(thread_pool_t));
+    int state;
+
+    if (!may_grow(tp, now)) return;
+
+    pthread_mutex_lock(&tp->job_mutex);
+
+    if (atomic_load(&tp->allow_new_jobs) && may_grow(tp, now))
+        for (idx = 0; idx < tp->max_threads; ++idx) {
+            state = atomic_load(&tp->thread_descr[idx].state);
+
+            if (state != WORKER_FREE && state != WORKER_EXITED) continue;
+
+            atomic_store(&tp->last_grow, now);
+            atomic_fetch_add(&tp->grows, 1);
+            start_worker_at(tp, idx);
+            break;
+        }
+
+    pthread_mutex_unlock(&tp->job_mutex);
+}
+
+thread_pool_t *thread_pool_init(size_t thread_count) {
+    thread_pool_params_t params = {
+        .thread_count = thread_count
+    };
+
+    return thread_pool_init_params(&params);
+}
+
+thread_pool_t *thread_pool_init_params(const thread_pool_params_t *params) {
+    size_t idx, thread_count, min_threads, max_threads, queue_size = 1;
+    thread_pool_t *tp;
     thread_descr_t *td;
+    tp_lane_t *lane;
+
+    if (!params || params->full_policy >= TP_FULL_COUNT) return NULL;
+
+    thread_count = params->thread_count;
+    min_threads = params->min_threads ? params->min_threads : thread_count;
+    if (thread_count < min_threads) thread_count = min_threads;
+    max_threads = params->max_threads > thread_count
+                   ? params->max_threads
+                   : thread_count;
+
+    while (queue_size < (params->queue_size
+                         ? params->queue_size
+                         : THREAD_POOL_DEFAULT_QUEUE_SIZE))
+        queue_size <<= 1;
+
+    tp = allocate(sizeof(thread_pool_t));
+    if (!tp) return NULL;
+
+    for (idx = 0; idx < TP_PRIORITY_COUNT; ++idx) {
+        lane = tp->lane + idx;
+        lane->ring = allocate(queue_size * sizeof(job_t));
 
-    tp->queue = list_init(sizeof(job_t));
+        if (!lane->ring) goto fail_lanes;
+
+        lane->ring_size = queue_size;
+        lane->ring_head = lane->ring_tail = 0;
+        atomic_init(&lane->injected, 0);
+        atomic_init(&lane->depth, 0);
+        atomic_init(&lane->posted, 0);
+        atomic_init(&lane->taken, 0);
+        atomic_init(&lane->max_depth, 0);
+        atomic_init(&lane->wait_nsec, 0);
+        atomic_init(&lane->max_wait_nsec, 0);
+    }
+
+    tp->full_policy = params->full_policy;
+    tp->full_waiters = 0;
+    tp->interactive_burst = params->interactive_burst;
+    tp->timing = params->timing;
+    tp->elastic = max_threads > min_threads;
+    tp->min_threads = min_threads;
+    tp->max_threads = max_threads;
+    tp->grow_wait_nsec = 1000ULL * (params->grow_wait_usec
+                                     ? params->grow_wait_usec
+                                     : THREAD_POOL_DEFAULT_GROW_WAIT_USEC);
+    tp->idle_timeout_msec = params->idle_timeout_msec
+                             ? params->idle_timeout_msec
+                             : THREAD_POOL_DEFAULT_IDLE_TIMEOUT_MSEC;
+    tp->cpu_count = params->cpus ? params->cpu_count : 0;
+    tp->cpus = NULL;
+    tp->numa_nodes = params->numa_nodes;
+    tp->before_job = params->before_job;
+    tp->after_job = params->after_job;
+    tp->hook_ctx = params->hook_ctx;
+    memset(&tp->wait_nsec, 0, sizeof(tp->wait_nsec));
+    memset(&tp->exec_nsec, 0, sizeof(tp->exec_nsec));
+
+    if (tp->cpu_count) {
+        tp->cpus = allocate(tp->cpu_count * sizeof(int));
+        if (!tp->cpus) {
+            idx = TP_PRIORITY_COUNT;
+            goto fail_lanes;
+        }
+
+        for (idx = 0; idx < tp->cpu_count; ++idx)
+            tp->cpus[idx] = params->cpus[idx];
+    }
 
     pthread_mutex_init(&tp->job_mutex, NULL);
     pthread_cond_init(&tp->job_semaphore, NULL);
     pthread_cond_init(&tp->job_end_semaphore, NULL);
+    pthread_cond_init(&tp->job_slot_semaphore, NULL);
+
+    atomic_init(&tp->run, true);
+    atomic_init(&tp->allow_new_jobs, true);
+    atomic_init(&tp->queued, 0);
+    atomic_init(&tp->sleepers, 0);
+    atomic_init(&tp->active, 0);
+    atomic_init(&tp->last_take, now_nsec());
+    atomic_init(&tp->last_grow, 0);
+    atomic_init(&tp->grows, 0);
+    atomic_init(&tp->shrinks, 0);
+    atomic_init(&tp->max_queued, 0);
+    td = allocate(max_threads * sizeof(thread_descr_t));
+    if (!td) goto fail_sync;
 
-    tp->run = tp->allow_new_jobs = true;
-    tp->thread_count = thread_count;
-    td = allocate(thread_count * sizeof(thread_descr_t));
     tp->thread_descr = td;
 
-    for (idx = 0; idx < thread_count; ++idx, ++td) {
-        pthread_attr_init(&td->attr);
-        pthread_attr_setdetachstate(&td->attr, PTHREAD_CREATE_JOINABLE);
-        pthread_create(&td->id, &td->attr, worker_tpl, tp);
+    /* deques should be there before any worker tries to steal */
+    for (idx = 0; idx < max_threads; ++idx) {
+        atomic_init(&td[idx].state, WORKER_FREE);
+        atomic_init(&td[idx].completed, 0);
+        atomic_init(&td[idx].busy_nsec, 0);
+        atomic_init(&td[idx].idle_nsec, 0);
+        td[idx].tp = tp;
+        td[idx].seed = (unsigned)idx + 1;
+        td[idx].burst = 0;
+        if (!deque_init(&td[idx].deque, DEQUE_INITIAL_SIZE)) goto fail_deques;
     }
 
+    pthread_mutex_lock(&tp->job_mutex);
+    for (idx = 0; idx < thread_count; ++idx)
+        start_worker_at(tp, idx);
+    pthread_mutex_unlock(&tp->job_mutex);
+
     return tp;
+
+fail_deques:
+    /* deque_init leaves nothing behind when it fails */
+    while (idx--) deque_deinit(&td[idx].deque);
+    deallocate(td);
+
+fail_sync:
+    pthread_mutex_destroy(&tp->job_mutex);
+    pthread_cond_destroy(&tp->job_semaphore);
+    pthread_cond_destroy(&tp->job_end_semaphore);
+    pthread_cond_destroy(&tp->job_slot_semaphore);
+    deallocate(tp->cpus);
+    idx = TP_PRIORITY_COUNT;
+
+fail_lanes:
+    while (idx--) deallocate(tp->lane[idx].ring);
+    deallocate(tp);
+    return NULL;
 }
 
 void thread_pool_stop(thread_pool_t *tp, bool wait_for_stop) {
-    size_t idx, tc = tp->thread_count;
+    size_t idx, tc = tp->max_threads;
 
     pthread_mutex_lock(&tp->job_mutex);
-    tp->run = wait_for_stop;
-    tp->allow_new_jobs = false;
+    atomic_store(&tp->run, wait_for_stop);
+    atomic_store(&tp->allow_new_jobs, false);
     pthread_cond_broadcast(&tp->job_semaphore);
+    pthread_cond_broadcast(&tp->job_slot_semaphore);
 
-    if (wait_for_stop && (list_size(tp->queue) != 0))
+    while (wait_for_stop && atomic_load(&tp->queued) != 0)
         pthread_cond_wait(&tp->job_end_semaphore, &tp->job_mutex);
 
-    tp->run = false;
+    atomic_store(&tp->run, false);
     pthread_cond_broadcast(&tp->job_semaphore);
 
     pthread_mutex_unlock(&tp->job_mutex);
 
+    /* no worker is started once new jobs are not allowed */
     for (idx = 0; idx < tc; ++idx) {
         void *p;
+
+        if (atomic_load(&tp->thread_descr[idx].state) == WORKER_FREE)
+            continue;
+
         pthread_join(tp->thread_descr[idx].id, &p);
         pthread_attr_destroy(&tp->thread_descr[idx].attr);
     }
 
+    /* workers still running may steal from any deque */
+    for (idx = 0; idx < tc; ++idx)
+        deque_deinit(&tp->thread_descr[idx].deque);
+
     pthread_mutex_destroy(&tp->job_mutex);
     pthread_cond_destroy(&tp->job_semaphore);
     pthread_cond_destroy(&tp->job_end_semaphore);
+    pthread_cond_destroy(&tp->job_slot_semaphore);
 
     deallocate(tp->thread_descr);
-    list_deinit(tp->queue);
+    deallocate(tp->cpus);
+    for (idx = 0; idx < TP_PRIORITY_COUNT; ++idx)
+        deallocate(tp->lane[idx].ring);
     deallocate(tp);
 }
 
-void thread_pool_post_job(thread_pool_t *tp, tp_job_function_t job, void *ctx) {
+static bool post_job(thread_pool_t *tp, tp_priority_t prio, job_t *job) {
+    thread_descr_t *self = current_worker;
+    tp_lane_t *lane;
+    bool ret;
+
+    if (prio >= TP_PRIORITY_COUNT) return false;
+    if (!atomic_load(&tp->allow_new_jobs)) return false;
+
+    lane = tp->lane + prio;
+    job->posted = tp->timing || tp->elastic ? now_nsec() : 0;
+
+    if (tp->elastic) check_pressure(tp, job->posted);
+
+    atomic_max(&tp->max_queued, atomic_fetch_add(&tp->queued, 1) + 1);
+    lane_posted(lane, 1);
+
+    /* worker of this very pool keeps background job for itself */
+    if (prio == TP_PRIORITY_BACKGROUND && self && self->tp == tp &&
+        deque_push(&self->deque, job)) {
+        wake_worker(tp);
+        return true;
+    }
+
     pthread_mutex_lock(&tp->job_mutex);
-    if (tp->allow_new_jobs) {
-        push_job(tp, job, ctx);
-        pthread_cond_broadcast(&tp->job_semaphore);
+    ret = push_job(tp, lane, job);
+
+    if (!ret) {
+        lane_unposted(lane, 1);
+
+        /* stopper may wait for the count to drain */
+        if (atomic_fetch_sub(&tp->queued, 1) == 1)
+            pthread_cond_broadcast(&tp->job_end_semaphore);
+    } else if (atomic_load(&tp->sleepers))
+        pthread_cond_signal(&tp->job_semaphore);
+
+    pthread_mutex_unlock(&tp->job_mutex);
+
+    return ret;
+}
+
+bool thread_pool_post_job(thread_pool_t *tp, tp_job_function_t job, void *ctx) {
+    return thread_pool_post_job_prio(tp, TP_PRIORITY_BACKGROUND, job, ctx);
+}
+
+bool thread_pool_post_job_prio(thread_pool_t *tp, tp_priority_t prio,
+                               tp_job_function_t job, void *ctx) {
+    job_t job_el = {
+        .job = job,
+        .ctx = ctx,
+        .group = NULL
+    };
+
+    return post_job(tp, prio, &job_el);
+}
+
+size_t thread_pool_post_jobs(thread_pool_t *tp, const tp_job_t *jobs, size_t n) {
+    thread_descr_t *self = current_worker;
+    tp_lane_t *lane = tp->lane + TP_PRIORITY_BACKGROUND;
+    size_t idx = 0, woken = 0;
+    job_t job_el = { .group = NULL };
+
+    if (!n || !atomic_load(&tp->allow_new_jobs)) return 0;
+
+    job_el.posted = tp->timing || tp->elastic ? now_nsec() : 0;
+
+    if (tp->elastic) check_pressure(tp, job_el.posted);
+
+    atomic_max(&tp->max_queued, atomic_fetch_add(&tp->queued, n) + n);
+    lane_posted(lane, n);
+
+    /* worker of this very pool keeps the jobs for itself */
+    if (self && self->tp == tp)
+        for (; idx < n; ++idx) {
+            job_el.job = jobs[idx].job;
+            job_el.ctx = jobs[idx].ctx;
+
+            if (!deque_push(&self->deque, &job_el)) break;
+        }
+
+    pthread_mutex_lock(&tp->job_mutex);
+
+    for (; idx < n; ++idx) {
+        job_el.job = jobs[idx].job;
+        job_el.ctx = jobs[idx].ctx;
+
+        /* parked workers should drain the ring the poster waits on */
+        if (ring_count(lane) == lane->ring_size) {
+            wake_sleepers(tp, idx - woken);
+            woken = idx;
+        }
+
+        if (!push_job(tp, lane, &job_el)) break;
     }
+
+    if (idx < n) {
+        lane_unposted(lane, n - idx);
+
+        if (atomic_fetch_sub(&tp->queued, n - idx) == n - idx)
+            pthread_cond_broadcast(&tp->job_end_semaphore);
+    }
+
+    wake_sleepers(tp, idx - woken);
+
     pthread_mutex_unlock(&tp->job_mutex);
+
+    return idx;
+}
+
+void thread_pool_lane_stats(thread_pool_t *tp, tp_priority_t prio,
+                            thread_pool_lane_stats_t *stats) {
+    tp_lane_t *lane;
+
+    if (!tp || !stats || prio >= TP_PRIORITY_COUNT) return;
+
+    lane = tp->lane + prio;
+
+    stats->posted = atomic_load(&lane->posted);
+    stats->taken = atomic_load(&lane->taken);
+    stats->depth = atomic_load(&lane->depth);
+    stats->max_depth = atomic_load(&lane->max_depth);
+    stats->wait_nsec = atomic_load(&lane->wait_nsec);
+    stats->max_wait_nsec = atomic_load(&lane->max_wait_nsec);
+}
+
+void thread_pool_stats(thread_pool_t *tp, thread_pool_stats_t *stats) {
+    thread_descr_t *td;
+    size_t idx;
+
+    if (!tp || !stats) return;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (idx = 0; idx < TP_PRIORITY_COUNT; ++idx)
+        stats->posted += atomic_load(&tp->lane[idx].posted);
+
+    /* descriptors keep counters of retired workers */
+    for (idx = 0; idx < tp->max_threads; ++idx) {
+        td = tp->thread_descr + idx;
+        stats->completed += atomic_load(&td->completed);
+        stats->busy_nsec += atomic_load(&td->busy_nsec);
+        stats->idle_nsec += atomic_load(&td->idle_nsec);
+    }
+
+    stats->depth = atomic_load(&tp->queued);
+    stats->max_depth = atomic_load(&tp->max_queued);
+    histogram_fetch(&tp->wait_nsec, &stats->wait_nsec);
+    histogram_fetch(&tp->exec_nsec, &stats->exec_nsec);
+
+    stats->threads = atomic_load(&tp->active);
+    stats->min_threads = tp->min_threads;
+    stats->max_threads = tp->max_threads;
+    stats->grows = atomic_load(&tp->grows);
+    stats->shrinks = atomic_load(&tp->shrinks);
+}
+
+tp_group_t *tp_group_init(thread_pool_t *tp) {
+    tp_group_t *grp;
+
+    if (!tp) return NULL;
+
+    grp = allocate(sizeof(tp_group_t));
+    if (!grp) return NULL;
+
+    grp->tp = tp;
+    atomic_init(&grp->pending, 0);
+    pthread_mutex_init(&grp->mutex, NULL);
+    pthread_cond_init(&grp->drained, NULL);
+    grp->then = NULL;
+    grp->then_ctx = NULL;
+
+    return grp;
+}
+
+void tp_group_deinit(tp_group_t *grp) {
+    if (!grp) return;
+
+    pthread_mutex_destroy(&grp->mutex);
+    pthread_cond_destroy(&grp->drained);
+    deallocate(grp);
+}
+
+bool tp_group_post_job(tp_group_t *grp, tp_job_function_t job, void *ctx) {
+    job_t job_el = {
+        .job = job,
+        .ctx = ctx,
+        .group = grp
+    };
+
+    atomic_fetch_add(&grp->pending, 1);
+
+    if (post_job(grp->tp, TP_PRIORITY_BACKGROUND, &job_el)) return true;
+
+    group_job_done(grp);
+
+    return false;
+}
+
+void tp_group_wait(tp_group_t *grp) {
+    thread_descr_t *self = current_worker;
+    thread_pool_t *tp = grp->tp;
+    bool helping = self && self->tp == tp;
+    struct timespec deadline;
+    job_t job;
+
+    /* blocking worker could starve jobs the group waits for */
+    while (helping && atomic_load(&grp->pending)) {
+        if (take_job(tp, self, &job)) {
+            job_taken(tp);
+            run_job(tp, self, &job);
+            continue;
+        }
+
+        pthread_mutex_lock(&grp->mutex);
+
+        if (atomic_load(&grp->pending)) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += GROUP_HELP_WAIT_NSEC;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_nsec -= 1000000000;
+                ++deadline.tv_sec;
+            }
+
+            pthread_cond_timedwait(&grp->drained, &grp->mutex, &deadline);
+        }
+
+        pthread_mutex_unlock(&grp->mutex);
+    }
+
+    pthread_mutex_lock(&grp->mutex);
+
+    while (atomic_load(&grp->pending))
+        pthread_cond_wait(&grp->drained, &grp->mutex);
+
+    pthread_mutex_unlock(&grp->mutex);
+}
+
+void tp_group_then(tp_group_t *grp, tp_job_function_t job, void *ctx) {
+    bool now;
+
+    pthread_mutex_lock(&grp->mutex);
+
+    now = !atomic_load(&grp->pending);
+
+    if (!now) {
+        grp->then = job;
+        grp->then_ctx = ctx;
+    }
+
+    pthread_mutex_unlock(&grp->mutex);
+
+    if (now) (*job)(ctx);
+}
+
+size_t tp_group_pending(tp_group_t *grp) {
+    return atomic_load(&grp->pending);
 }
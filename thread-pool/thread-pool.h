@@ -11,8 +11,171 @@ typedef void (*tp_job_function_t)(void *);
 struct thread_pool;
 typedef struct thread_pool thread_pool_t;
 
+/** Group of jobs which can be waited for
+ */
+struct tp_group;
+typedef struct tp_group tp_group_t;
+
+/** Job with its context, used for batch posting
+ */
+typedef struct tp_job {
+    tp_job_function_t job;
+    void *ctx;
+} tp_job_t;
+
+# define THREAD_POOL_DEFAULT_QUEUE_SIZE 1024
+# define THREAD_POOL_DEFAULT_GROW_WAIT_USEC 10000
+# define THREAD_POOL_DEFAULT_IDLE_TIMEOUT_MSEC 5000
+
+/** What to do when job queue is full
+ */
+typedef enum tp_full_policy {
+    TP_FULL_BLOCK = 0,                                      ///< wait for a free slot
+    TP_FULL_GROW = 1,                                       ///< double the queue
+    TP_FULL_REJECT = 2,                                     ///< fail the post
+    TP_FULL_COUNT
+} tp_full_policy_t;
+
+/** Job priority lane
+ */
+typedef enum tp_priority {
+    TP_PRIORITY_INTERACTIVE = 0,                            ///< latency critical jobs
+    TP_PRIORITY_BACKGROUND = 1,                             ///< bulk jobs, the default
+    TP_PRIORITY_COUNT
+} tp_priority_t;
+
+/** Hook called around every job execution
+ * \param [in] job job function about to run or just completed
+ * \param [in] nsec execution time, \c 0 before job or if timing is off
+ */
+typedef void (*tp_job_hook_t)(tp_job_function_t job, void *ctx,
+                              unsigned long long nsec, void *hook_ctx);
+
+/** Thread pool parameters
+ */
+typedef struct thread_pool_params {
+    size_t thread_count;                                    ///< workers started initially
+    /** Elastic pool bounds. Pool is elastic if \c max_threads is greater
+     * than \c thread_count. \c min_threads defaults to \c thread_count.
+     */
+    size_t min_threads;
+    size_t max_threads;
+    /** Worker is added if a job waited for longer than this or no worker
+     * took a job for this long while jobs are queued
+     */
+    unsigned long grow_wait_usec;
+    unsigned long idle_timeout_msec;                        ///< idle time before worker retires
+    size_t queue_size;                                      ///< slots preallocated per lane
+    tp_full_policy_t full_policy;
+    /** Interactive jobs taken by worker in a row before it gives a
+     * background job a chance, zero for strict priority
+     */
+    size_t interactive_burst;
+    bool timing;                                            ///< measure queue wait time
+    /** CPUs to pin workers to, worker \c i is pinned to
+     * \c cpus[i % cpu_count]. Use \c io_service_group_cpu to run workers
+     * next to IO service.
+     */
+    const int *cpus;
+    size_t cpu_count;
+    /** Mask of NUMA nodes to keep workers on, used if no \c cpus given.
+     * Bit \c n stands for node \c n.
+     */
+    unsigned long numa_nodes;
+    tp_job_hook_t before_job;                               ///< called in worker before job
+    tp_job_hook_t after_job;                                ///< called in worker after job
+    void *hook_ctx;
+} thread_pool_params_t;
+
+/** Priority lane statistics snapshot
+ */
+typedef struct thread_pool_lane_stats {
+    unsigned long long posted;
+    unsigned long long taken;                               ///< jobs taken off the queues
+    size_t depth;                                           ///< jobs queued now
+    size_t max_depth;
+    /* measured if timing parameter is set */
+    unsigned long long wait_nsec;                           ///< total time jobs spent queued
+    unsigned long long max_wait_nsec;
+} thread_pool_lane_stats_t;
+
+/** Thread pool statistics snapshot
+ */
+typedef struct thread_pool_stats {
+    size_t threads;                                         ///< workers running now
+    size_t min_threads;
+    size_t max_threads;
+    unsigned long long grows;                               ///< workers added on queue pressure
+    unsigned long long shrinks;                             ///< idle workers retired
+    unsigned long long posted;
+    unsigned long long completed;                           ///< jobs executed
+    size_t depth;                                           ///< jobs queued now
+    size_t max_depth;                                       ///< high-water mark of queued jobs
+    /* measured if timing parameter is set */
+    unsigned long long busy_nsec;                           ///< time workers spent in jobs
+    unsigned long long idle_nsec;                           ///< time workers spent parked
+    histogram_t wait_nsec;                                  ///< time from post to take
+    histogram_t exec_nsec;                                  ///< job execution time
+} thread_pool_stats_t;
+
 thread_pool_t *thread_pool_init(size_t thread_count);
+/** Thread pool c-tor
+ * \param [in] params parameters, defaults are used for zero fields
+ */
+thread_pool_t *thread_pool_init_params(const thread_pool_params_t *params);
 void thread_pool_stop(thread_pool_t *tp, bool wait_for_stop);
-void thread_pool_post_job(thread_pool_t *tp, tp_job_function_t job, void *ctx);
+/** Post job to pool
+ * Jobs posted from pool workers go to worker's own deque and never block.
+ * \return \c false if pool is being stopped or the queue is full with
+ *         \c TP_FULL_REJECT policy
+ */
+bool thread_pool_post_job(thread_pool_t *tp, tp_job_function_t job, void *ctx);
+/** Post job to pool with given priority
+ * Interactive jobs always go to the shared interactive queue.
+ */
+bool thread_pool_post_job_prio(thread_pool_t *tp, tp_priority_t prio,
+                               tp_job_function_t job, void *ctx);
+/** Fetch statistics snapshot of priority lane
+ */
+void thread_pool_lane_stats(thread_pool_t *tp, tp_priority_t prio,
+                            thread_pool_lane_stats_t *stats);
+/** Fetch statistics snapshot
+ * \c busy_nsec divided by sum of \c busy_nsec and \c idle_nsec gives
+ * busy ratio of workers.
+ */
+void thread_pool_stats(thread_pool_t *tp, thread_pool_stats_t *stats);
+/** Post batch of background jobs to pool
+ * Jobs are queued under single lock acquisition and at most
+ * min(\c n, idle workers) workers are woken up.
+ * \return count of jobs posted, jobs are posted in order so the rest
+ *         of \c jobs starting at returned index is not posted
+ */
+size_t thread_pool_post_jobs(thread_pool_t *tp, const tp_job_t *jobs, size_t n);
+
+/** Job group c-tor
+ */
+tp_group_t *tp_group_init(thread_pool_t *tp);
+/** Job group d-tor, group should be drained
+ */
+void tp_group_deinit(tp_group_t *grp);
+/** Post job to pool as a member of the group
+ * Failed post leaves pending count as it was. If the group drains with
+ * it, continuation set with \c tp_group_then fires in the calling thread.
+ * \return \c false if job was not posted, see \c thread_pool_post_job
+ */
+bool tp_group_post_job(tp_group_t *grp, tp_job_function_t job, void *ctx);
+/** Wait until all jobs of the group are executed
+ * Pool worker executes queued jobs while waiting instead of blocking.
+ */
+void tp_group_wait(tp_group_t *grp);
+/** Set job to run once the group drains
+ * Continuation runs once in the thread executing the last job of the
+ * group, or right away if the group is drained already. It may still be
+ * running when \c tp_group_wait returns.
+ */
+void tp_group_then(tp_group_t *grp, tp_job_function_t job, void *ctx);
+/** Count of group jobs posted and not executed yet
+ */
+size_t tp_group_pending(tp_group_t *grp);
 
 #endif /* _THREAD_POOL_ */
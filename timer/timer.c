@@ -1,13 +1,25 @@
 #include "timer.h"
+#include "wheel.h"
 #include "common.h"
 #include "io-service.h"
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/timerfd.h>
 
+/* Timers of a service share a single timer wheel driven by one timerfd.
+ * The wheel is attached to the service on first timer init. Its timerfd
+ * is armed for the next tick the wheel should be advanced at and has a
+ * oneshot job posted only while there are timers armed.
+ */
+
+#define TIMERS_FIRED_INITIAL 64
+
 typedef enum timer_class_enum {
     absolute,
     relative,
@@ -15,127 +27,505 @@ typedef enum timer_class_enum {
     none
 } timer_class_t;
 
-struct tmr {
+typedef struct fired_timer {
+    tmr_job_t job;
+    tmr_batch_job_t batch;                                  ///< job is NULL if set
+    void *ctx;
+} fired_timer_t;
+
+typedef struct timers {
+    io_service_t *iosvc;
     int fd;
-    bool armed;
+    pthread_mutex_t mutex;                                  ///< guards everything below
+    wheel_t wheel;
+    uint64_t base;                                          ///< monotonic time of tick 0
+    uint64_t armed;                                         ///< tick timerfd is armed for
+    bool posted;                                            ///< timerfd job is posted
+    unsigned long long rearms;
+    unsigned long long wakeups;
+    unsigned long long expired;
+    /* spare array of expired timers, taken by the timerfd job while it
+     * calls them as the job may be run by several threads at once */
+    fired_timer_t *fired;
+    size_t fired_size;
+} timers_t;
+
+struct tmr {
+    wheel_node_t node;                                      ///< should be the first one
+    timers_t *timers;
     timer_class_t tmr_class;
-    struct itimerspec spec;
-    io_service_t *master;
+    uint64_t period;                                        ///< ticks
+    uint64_t deadline;                                      ///< tick requested
+    uint64_t slack;                                         ///< ticks expiry may be late by
     tmr_job_t job;
+    tmr_batch_job_t batch;
     void *ctx;
 };
 
-static void tmr_job_tpl(int fd, io_svc_op_t op, void *_ctx) {
-    tmr_t *timer = _ctx;
-    uint64_t stub;
+static inline
+uint64_t ts_nsec(time_t sec, unsigned long nanosec) {
+    return (uint64_t)sec * 1000000000ULL + nanosec;
+}
+
+/* first tick not before monotonic time */
+static inline
+uint64_t tick_ceil(const timers_t *timers, uint64_t nsec) {
+    if (nsec <= timers->base) return 0;
+
+    return (nsec - timers->base + TIMER_TICK_NSEC - 1) / TIMER_TICK_NSEC;
+}
+
+/* First tick not before the delay from now. Cached time of the service
+ * lags behind by the time spent in callbacks since the wakeup and may be
+ * read from another clock than timerfd one, so it is not used here.
+ */
+static inline
+uint64_t tick_after(const timers_t *timers, time_t sec, unsigned long nanosec) {
+    return tick_ceil(timers, now_nsec() + ts_nsec(sec, nanosec));
+}
+
+static inline
+uint64_t tick_floor(const timers_t *timers, uint64_t nsec) {
+    if (nsec <= timers->base) return 0;
+
+    return (nsec - timers->base) / TIMER_TICK_NSEC;
+}
+
+/* Round deadline up to a multiple of the largest power of two not above
+ * slack. Timers with close deadlines and similar slack share the tick then,
+ * which is also a cascade point of the wheel for large slacks.
+ */
+static inline
+uint64_t apply_slack(uint64_t deadline, uint64_t slack) {
+    uint64_t mask;
+
+    if (!slack) return deadline;
+
+    mask = (1ULL << (63 - __builtin_clzll(slack))) - 1;
+
+    if (deadline > UINT64_MAX - mask) return deadline;
+
+    return (deadline + mask) & ~mask;
+}
+
+static void timers_job(int fd, io_svc_op_t op, void *ctx);
+
+/* Arm timerfd for the next tick of the wheel, called with mutex locked.
+ * Returns false if timerfd job can not be posted, e.g. the service is
+ * stopped.
+ */
+static
+bool timers_reprogram(timers_t *timers) {
+    uint64_t next = wheel_next(&timers->wheel), nsec;
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+
+    if (next == WHEEL_NEVER) {
+        if (timers->armed != WHEEL_NEVER) {
+            timerfd_settime(timers->fd, 0, &spec, NULL);
+            ++timers->rearms;
+        }
+
+        timers->armed = WHEEL_NEVER;
+
+        /* the service is not kept running for an empty wheel */
+        if (timers->posted)
+            io_service_remove_job(timers->iosvc, timers->fd, IO_SVC_OP_READ,
+                                  timers_job, timers);
+
+        timers->posted = false;
+        return true;
+    }
+
+    if (next != timers->armed) {
+        nsec = timers->base + next * TIMER_TICK_NSEC;
+        spec.it_value.tv_sec = nsec / 1000000000ULL;
+        spec.it_value.tv_nsec = nsec % 1000000000ULL;
+        timerfd_settime(timers->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+        timers->armed = next;
+        ++timers->rearms;
+    }
+
+    if (!timers->posted)
+        timers->posted = io_service_post_job(timers->iosvc, timers->fd,
+                                             IO_SVC_OP_READ, true,
+                                             timers_job, timers);
+
+    return timers->posted;
+}
+
+/* collect expired timer */
+static
+bool timers_fire(fired_timer_t **fired, size_t *size, size_t count,
+                 const tmr_t *tmr) {
+    fired_timer_t *f;
+    size_t new_size;
+
+    if (count == *size) {
+        new_size = *size ? 2 * *size : TIMERS_FIRED_INITIAL;
+        f = reallocate(*fired, new_size * sizeof(fired_timer_t));
+        if (!f) return false;
+
+        *fired = f;
+        *size = new_size;
+    }
+
+    (*fired)[count].job = tmr->job;
+    (*fired)[count].batch = tmr->batch;
+    (*fired)[count].ctx = tmr->ctx;
+
+    return true;
+}
+
+/* Call expired timers, the ones with batch job are grouped by it.
+ * Each batch is delivered at position of its first timer.
+ */
+static
+void timers_call(fired_timer_t *fired, size_t count) {
+    void **ctxs = NULL;
+    tmr_batch_job_t batch;
+    size_t idx, next, n;
+
+    for (idx = 0; idx < count; ++idx) {
+        if (fired[idx].job) {
+            (*fired[idx].job)(fired[idx].ctx);
+            continue;
+        }
+
+        batch = fired[idx].batch;
+
+        /* delivered already with its batch */
+        if (!batch) continue;
+
+        if (!ctxs) ctxs = allocate((count - idx) * sizeof(void *));
+
+        /* no memory, deliver one by one */
+        if (!ctxs) {
+            (*batch)(&fired[idx].ctx, 1);
+            continue;
+        }
+
+        for (next = idx, n = 0; next < count; ++next) {
+            if (fired[next].job || fired[next].batch != batch) continue;
+
+            ctxs[n++] = fired[next].ctx;
+            fired[next].batch = NULL;
+        }
+
+        (*batch)(ctxs, n);
+    }
+
+    deallocate(ctxs);
+}
+
+/* Advance the wheel and call expired timers.
+ * Periodic timers are re-armed before their jobs are called, so that jobs
+ * may re-arm, cancel or deinit their timers.
+ */
+static
+void timers_job(int fd, io_svc_op_t op, void *ctx) {
+    timers_t *timers = ctx;
+    wheel_node_t expired, *n;
+    tmr_t *tmr;
+    fired_timer_t *fired;
+    uint64_t stub, next, now;
+    size_t count = 0, size;
 
     read(fd, &stub, sizeof(stub));
 
-    timer->job(timer->ctx);
+    wheel_list_init(&expired);
+
+    pthread_mutex_lock(&timers->mutex);
+
+    now = tick_floor(timers, now_nsec());
+
+    /* the oneshot job is consumed */
+    timers->posted = false;
+    timers->armed = WHEEL_NEVER;
+
+    fired = timers->fired;
+    size = timers->fired_size;
+    timers->fired = NULL;
+    timers->fired_size = 0;
+
+    wheel_advance(&timers->wheel, now, &expired);
+
+    while ((n = wheel_list_pop(&expired))) {
+        tmr = (tmr_t *)n;
+
+        /* retry on the next tick if there is no memory for the job */
+        if (!timers_fire(&fired, &size, count, tmr)) {
+            wheel_add(&timers->wheel, n, timers->wheel.now + 1);
+            continue;
+        }
+
+        ++count;
+
+        if (tmr->tmr_class == periodic) {
+            /* periods are counted from requested deadline, not rounded one */
+            next = tmr->deadline + tmr->period;
+
+            /* missed periods are skipped */
+            if (next <= timers->wheel.now)
+                next = timers->wheel.now + tmr->period;
+
+            tmr->deadline = next;
+            wheel_add(&timers->wheel, n, apply_slack(next, tmr->slack));
+        } else
+            tmr->tmr_class = none;
+    }
+
+    ++timers->wakeups;
+    timers->expired += count;
+
+    timers_reprogram(timers);
+
+    pthread_mutex_unlock(&timers->mutex);
 
-    if (timer->tmr_class != periodic)
-        timer->armed = false;
+    timers_call(fired, count);
+
+    pthread_mutex_lock(&timers->mutex);
+
+    /* keep the larger one */
+    if (size > timers->fired_size) {
+        deallocate(timers->fired);
+        timers->fired = fired;
+        timers->fired_size = size;
+    } else
+        deallocate(fired);
+
+    pthread_mutex_unlock(&timers->mutex);
+}
+
+static
+void timers_deinit(void *obj) {
+    timers_t *timers = obj;
+
+    io_service_remove_job(timers->iosvc, timers->fd, IO_SVC_OP_READ,
+                          timers_job, timers);
+    close(timers->fd);
+    pthread_mutex_destroy(&timers->mutex);
+    deallocate(timers->fired);
+    deallocate(timers);
+}
+
+/* fetch wheel of the service, creating it on demand */
+static
+timers_t *timers_get(io_service_t *iosvc) {
+    timers_t *timers, *attached;
+
+    timers = io_service_attachment(iosvc, IO_SVC_ATTACHMENT_TIMERS);
+    if (timers) return timers;
+
+    timers = allocate(sizeof(timers_t));
+    if (!timers) return NULL;
+
+    timers->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    timers->fired = allocate(TIMERS_FIRED_INITIAL * sizeof(fired_timer_t));
+
+    if (timers->fd < 0 || !timers->fired) {
+        if (timers->fd >= 0) close(timers->fd);
+        deallocate(timers->fired);
+        deallocate(timers);
+        return NULL;
+    }
+
+    timers->iosvc = iosvc;
+    timers->fired_size = TIMERS_FIRED_INITIAL;
+    timers->base = now_nsec();
+    timers->armed = WHEEL_NEVER;
+    timers->posted = false;
+    timers->rearms = timers->wakeups = timers->expired = 0;
+    pthread_mutex_init(&timers->mutex, NULL);
+    wheel_init(&timers->wheel, 0);
+
+    attached = io_service_attach(iosvc, IO_SVC_ATTACHMENT_TIMERS,
+                                 timers, timers_deinit);
+
+    /* someone was faster */
+    if (attached != timers) {
+        close(timers->fd);
+        pthread_mutex_destroy(&timers->mutex);
+        deallocate(timers->fired);
+        deallocate(timers);
+    }
+
+    return attached;
+}
+
+static inline
+uint64_t ticks(time_t sec, unsigned long nanosec) {
+    return (ts_nsec(sec, nanosec) + TIMER_TICK_NSEC - 1) / TIMER_TICK_NSEC;
+}
+
+/* slack is rounded down so that expiry is never later than allowed */
+static inline
+uint64_t slack_nsec_ticks(time_t sec, unsigned long nanosec) {
+    return ts_nsec(sec, nanosec) / TIMER_TICK_NSEC;
+}
+
+static
+bool timer_arm(tmr_t *tmr, timer_class_t tmr_class, uint64_t deadline,
+               uint64_t period, uint64_t slack,
+               tmr_job_t job, tmr_batch_job_t batch, void *ctx) {
+    timers_t *timers = tmr->timers;
+    bool armed;
+
+    pthread_mutex_lock(&timers->mutex);
+
+    tmr->job = job;
+    tmr->batch = batch;
+    tmr->ctx = ctx;
+    tmr->tmr_class = tmr_class;
+    tmr->period = period;
+    tmr->deadline = deadline;
+    tmr->slack = slack;
+
+    wheel_add(&timers->wheel, &tmr->node, apply_slack(deadline, slack));
+    armed = timers_reprogram(timers);
+
+    /* the timer would never expire */
+    if (!armed) {
+        wheel_del(&timers->wheel, &tmr->node);
+        tmr->tmr_class = none;
+        timers_reprogram(timers);
+    }
+
+    pthread_mutex_unlock(&timers->mutex);
+
+    return armed;
 }
 
 tmr_t* timer_init(io_service_t* iosvc) {
     tmr_t *timer = NULL;
-    int fd;
+    timers_t *timers = timers_get(iosvc);
 
-    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-    if (fd < 0) return NULL;
+    if (!timers) return NULL;
 
     timer = allocate(sizeof(tmr_t));
-    if (!timer) {
-        close(fd);
-        return NULL;
-    }
+    if (!timer) return NULL;
 
-    timer->fd = fd;
-    timer->armed = false;
-    timer->master = iosvc;
+    wheel_node_init(&timer->node);
+    timer->timers = timers;
     timer->tmr_class = none;
+    timer->period = 0;
+    timer->deadline = 0;
+    timer->slack = 0;
+    timer->job = NULL;
+    timer->batch = NULL;
+    timer->ctx = NULL;
 
     return timer;
 }
 
+tmr_t *timer_init_group(io_service_group_t *grp) {
+    io_service_t *iosvc = io_service_group_next(grp);
+
+    return iosvc ? timer_init(iosvc) : NULL;
+}
+
 void timer_deinit(tmr_t* tmr) {
     timer_cancel(tmr);
-    close(tmr->fd);
     deallocate(tmr);
 }
 
-void timer_set_deadline(tmr_t *tmr,
+bool timer_set_deadline(tmr_t *tmr,
                         time_t sec, long unsigned int nanosec,
                         tmr_job_t job, void *ctx) {
-    tmr->job = job;
-    tmr->ctx = ctx;
+    return timer_arm(tmr, relative,
+                     tick_after(tmr->timers, sec, nanosec),
+                     0, 0, job, NULL, ctx);
+}
 
-    tmr->tmr_class = relative;
-    tmr->spec.it_value.tv_sec = sec;
-    tmr->spec.it_value.tv_nsec = nanosec;
-    tmr->spec.it_interval.tv_sec = tmr->spec.it_interval.tv_nsec = 0;
-    timerfd_settime(
-        tmr->fd, 0,
-        &tmr->spec,
-        NULL
-    );
+bool timer_set_periodic(tmr_t *tmr,
+                        time_t sec, long unsigned int nanosec,
+                        tmr_job_t job, void *ctx) {
+    return timer_set_periodic_slack(tmr, sec, nanosec, 0, 0, job, ctx);
+}
+
+bool timer_set_deadline_slack(tmr_t *tmr,
+                              time_t sec, unsigned long nanosec,
+                              time_t slack_sec, unsigned long slack_nanosec,
+                              tmr_job_t job, void *ctx) {
+    return timer_arm(tmr, relative,
+                     tick_after(tmr->timers, sec, nanosec),
+                     0, slack_nsec_ticks(slack_sec, slack_nanosec),
+                     job, NULL, ctx);
+}
 
-    tmr->armed = true;
+bool timer_set_periodic_slack(tmr_t *tmr,
+                              time_t sec, unsigned long nanosec,
+                              time_t slack_sec, unsigned long slack_nanosec,
+                              tmr_job_t job, void *ctx) {
+    uint64_t period = ticks(sec, nanosec);
 
-    io_service_post_job(tmr->master,
-                        tmr->fd, IO_SVC_OP_READ, true,
-                        tmr_job_tpl, tmr);
+    return timer_arm(tmr, periodic,
+                     tick_after(tmr->timers, sec, nanosec),
+                     period ? period : 1,
+                     slack_nsec_ticks(slack_sec, slack_nanosec),
+                     job, NULL, ctx);
 }
 
-void timer_set_periodic(tmr_t *tmr,
+bool timer_set_absolute(tmr_t *tmr,
                         time_t sec, long unsigned int nanosec,
                         tmr_job_t job, void *ctx) {
-    tmr->job = job;
-    tmr->ctx = ctx;
+    return timer_arm(tmr, absolute,
+                     tick_ceil(tmr->timers, ts_nsec(sec, nanosec)),
+                     0, 0, job, NULL, ctx);
+}
 
-    tmr->tmr_class = periodic;
-    tmr->spec.it_value.tv_sec = sec;
-    tmr->spec.it_value.tv_nsec = nanosec;
-    tmr->spec.it_interval.tv_sec = sec;
-    tmr->spec.it_interval.tv_nsec = nanosec;
-    timerfd_settime(
-        tmr->fd, 0,
-        &tmr->spec,
-        NULL
-    );
+bool timer_set_deadline_batch(tmr_t *tmr,
+                              time_t sec, long unsigned int nanosec,
+                              tmr_batch_job_t job, void *ctx) {
+    return timer_arm(tmr, relative,
+                     tick_after(tmr->timers, sec, nanosec),
+                     0, 0, NULL, job, ctx);
+}
 
-    tmr->armed = true;
+void timer_cancel(tmr_t *tmr) {
+    timers_t *timers = tmr->timers;
+
+    pthread_mutex_lock(&timers->mutex);
+
+    if (tmr->node.linked) {
+        wheel_del(&timers->wheel, &tmr->node);
+        timers_reprogram(timers);
+    }
+
+    tmr->tmr_class = none;
 
-    io_service_post_job(tmr->master,
-                        tmr->fd, IO_SVC_OP_READ, false,
-                        tmr_job_tpl, tmr);
+    pthread_mutex_unlock(&timers->mutex);
 }
 
-void timer_set_absolute(tmr_t *tmr,
-                        time_t sec, long unsigned int nanosec,
-                        tmr_job_t job, void *ctx) {
-    tmr->job = job;
-    tmr->ctx = ctx;
+uint64_t timer_expiry(tmr_t *tmr) {
+    timers_t *timers = tmr->timers;
+    uint64_t expiry = 0;
 
-    tmr->tmr_class = absolute;
-    tmr->spec.it_value.tv_sec = sec;
-    tmr->spec.it_value.tv_nsec = nanosec;
-    tmr->spec.it_interval.tv_sec = tmr->spec.it_interval.tv_nsec = 0;
-    timerfd_settime(
-        tmr->fd, TFD_TIMER_ABSTIME,
-        &tmr->spec,
-        NULL
-    );
+    pthread_mutex_lock(&timers->mutex);
 
-    tmr->armed = true;
+    if (tmr->node.linked)
+        expiry = timers->base + tmr->node.expires * TIMER_TICK_NSEC;
 
-    io_service_post_job(tmr->master,
-                        tmr->fd, IO_SVC_OP_READ, true,
-                        tmr_job_tpl, tmr);
+    pthread_mutex_unlock(&timers->mutex);
+
+    return expiry;
 }
 
-void timer_cancel(tmr_t *tmr) {
-    io_service_remove_job(tmr->master,
-                          tmr->fd, IO_SVC_OP_READ,
-                          tmr_job_tpl, tmr);
+void timer_stats(io_service_t *iosvc, timer_stats_t *stats) {
+    timers_t *timers;
+
+    if (!iosvc || !stats) return;
+
+    memset(stats, 0, sizeof(*stats));
+
+    timers = io_service_attachment(iosvc, IO_SVC_ATTACHMENT_TIMERS);
+    if (!timers) return;
+
+    pthread_mutex_lock(&timers->mutex);
+
+    stats->rearms = timers->rearms;
+    stats->wakeups = timers->wakeups;
+    stats->expired = timers->expired;
+    stats->armed = timers->wheel.count;
+
+    pthread_mutex_unlock(&timers->mutex);
 }
@@ -2,21 +2,79 @@
 # define _TIMER_H_
 
 # include "io-service.h"
+# include "io-service-group.h"
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
 # include <time.h>
 
+/** Timer precision
+ * Timers of a service are kept in a single timer wheel with this tick and
+ * expire at the first tick not before their deadline.
+ */
+# define TIMER_TICK_NSEC 1000000ULL
+
 typedef void (*tmr_job_t)(void *ctx);
+/** Job for timers expired at once
+ * \param ctx contexts of expired timers in order of expiry
+ */
+typedef void (*tmr_batch_job_t)(void **ctx, size_t count);
 
 struct tmr;
 typedef struct tmr tmr_t;
 
+/** Timers statistics snapshot of a service
+ */
+typedef struct timer_stats {
+    unsigned long long rearms;                              ///< timerfd_settime calls
+    unsigned long long wakeups;                             ///< timerfd jobs run
+    unsigned long long expired;                             ///< timers expired
+    size_t armed;                                           ///< timers in the wheel
+} timer_stats_t;
+
 tmr_t *timer_init(io_service_t *iosvc);
+/** Timer bound to a service picked from the group for its lifetime
+ */
+tmr_t *timer_init_group(io_service_group_t *grp);
 void timer_deinit(tmr_t *tmr);
-void timer_set_periodic(tmr_t *tmr, time_t sec, unsigned long nanosec,
+/* Setters below return \c false if the timer can not be armed as timerfd
+ * job can not be posted, e.g. the service is stopped. The timer is not
+ * armed then.
+ */
+bool timer_set_periodic(tmr_t *tmr, time_t sec, unsigned long nanosec,
                         tmr_job_t job, void *ctx);
-void timer_set_deadline(tmr_t *tmr, time_t sec, unsigned long nanosec,
+bool timer_set_deadline(tmr_t *tmr, time_t sec, unsigned long nanosec,
                         tmr_job_t job, void *ctx);
-void timer_set_absolute(tmr_t *tmr, time_t sec, unsigned long nanosec,
+bool timer_set_absolute(tmr_t *tmr, time_t sec, unsigned long nanosec,
                         tmr_job_t job, void *ctx);
+/** Timers with slack
+ * Expiry of the timer may be delayed by up to \c slack so that timers with
+ * close deadlines are rounded to the same tick and expire at one wakeup.
+ * Periods of periodic timer are counted from requested deadlines, thus
+ * slack does not accumulate.
+ */
+bool timer_set_deadline_slack(tmr_t *tmr, time_t sec, unsigned long nanosec,
+                              time_t slack_sec, unsigned long slack_nanosec,
+                              tmr_job_t job, void *ctx);
+bool timer_set_periodic_slack(tmr_t *tmr, time_t sec, unsigned long nanosec,
+                              time_t slack_sec, unsigned long slack_nanosec,
+                              tmr_job_t job, void *ctx);
+/** Deadline timer delivered in batches
+ * Timers of the service with the same batch job expired at the same wakeup
+ * are delivered with a single call to the job. The job may then post them
+ * to a thread pool with \c thread_pool_post_jobs at once.
+ */
+bool timer_set_deadline_batch(tmr_t *tmr, time_t sec, unsigned long nanosec,
+                              tmr_batch_job_t job, void *ctx);
 void timer_cancel(tmr_t *tmr);
+/** Monotonic time in nanoseconds the timer is to expire at
+ * The time is the tick the deadline is rounded to with slack applied.
+ * \return \c 0 if timer is not armed
+ */
+uint64_t timer_expiry(tmr_t *tmr);
+/** Statistics of the timers of the service
+ * Each timer expiry with no other timer sharing its tick costs a re-arm.
+ */
+void timer_stats(io_service_t *iosvc, timer_stats_t *stats);
 
 #endif /* _TIMER_H_ */
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include "wheel.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+static inline
+unsigned level_shift(unsigned level) {
+    return level * WHEEL_SLOT_BITS;
+}
+
+static inline
+uint64_t rotate_right(uint64_t x, unsigned r) {
+    return r ? (x >> r) | (x << (64 - r)) : x;
+}
+
+void wheel_list_init(wheel_node_t *head) {
+    head->prev = head->next = head;
+}
+
+bool wheel_list_empty(const wheel_node_t *head) {
+    return head->next == head;
+}
+
+static
+void list_append(wheel_node_t *head, wheel_node_t *n) {
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+static
+void list_unlink(wheel_node_t *n) {
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->prev = n->next = n;
+}
+
+/* move every node of src to the tail of dst */
+static
+void list_splice(wheel_node_t *dst, wheel_node_t *src) {
+    if (wheel_list_empty(src)) return;
+
+    src->next->prev = dst->prev;
+    dst->prev->next = src->next;
+    src->prev->next = dst;
+    dst->prev = src->prev;
+
+    wheel_list_init(src);
+}
+
+wheel_node_t *wheel_list_pop(wheel_node_t *head) {
+    wheel_node_t *n;
+
+    if (wheel_list_empty(head)) return NULL;
+
+    n = head->next;
+    list_unlink(n);
+
+    return n;
+}
+
+void wheel_init(wheel_t *w, uint64_t now) {
+    unsigned level, slot;
+
+    w->now = now;
+    w->count = 0;
+
+    for (level = 0; level < WHEEL_LEVELS; ++level) {
+        w->occupied[level] = 0;
+
+        for (slot = 0; slot < WHEEL_SLOTS; ++slot)
+            wheel_list_init(&w->slot[level][slot]);
+    }
+}
+
+void wheel_node_init(wheel_node_t *n) {
+    wheel_list_init(n);
+    n->expires = 0;
+    n->level = n->slot = 0;
+    n->linked = false;
+}
+
+/* place node which expires not before current tick, count is not touched */
+static
+void wheel_place(wheel_t *w, wheel_node_t *n) {
+    uint64_t expires = n->expires, delta = expires - w->now;
+    unsigned level;
+
+    for (level = 0; level < WHEEL_LEVELS; ++level)
+        if (delta < (1ULL << level_shift(level + 1))) break;
+
+    /* too far away, park at the farthest slot and re-place on cascade */
+    if (level == WHEEL_LEVELS) {
+        level = WHEEL_LEVELS - 1;
+        expires = w->now + (1ULL << level_shift(WHEEL_LEVELS)) - 1;
+    }
+
+    n->level = level;
+    n->slot = (expires >> level_shift(level)) & (WHEEL_SLOTS - 1);
+
+    list_append(&w->slot[level][n->slot], n);
+    w->occupied[level] |= 1ULL << n->slot;
+}
+
+void wheel_add(wheel_t *w, wheel_node_t *n, uint64_t expires) {
+    if (n->linked) wheel_del(w, n);
+
+    n->expires = expires > w->now ? expires : w->now + 1;
+    n->linked = true;
+    ++w->count;
+
+    wheel_place(w, n);
+}
+
+void wheel_del(wheel_t *w, wheel_node_t *n) {
+    if (!n->linked) return;
+
+    list_unlink(n);
+
+    if (wheel_list_empty(&w->slot[n->level][n->slot]))
+        w->occupied[n->level] &= ~(1ULL << n->slot);
+
+    n->linked = false;
+    --w->count;
+}
+
+/* Slot at distance d (1..64) ahead of current index of level k is
+ * processed when the tick reaches ((now >> 6k) + d) << 6k.
+ */
+uint64_t wheel_next(const wheel_t *w) {
+    uint64_t next = WHEEL_NEVER, tick, rot;
+    unsigned level, shift, cur;
+
+    for (level = 0; level < WHEEL_LEVELS; ++level) {
+        if (!w->occupied[level]) continue;
+
+        shift = level_shift(level);
+        cur = (w->now >> shift) & (WHEEL_SLOTS - 1);
+        rot = rotate_right(w->occupied[level], (cur + 1) & (WHEEL_SLOTS - 1));
+        tick = ((w->now >> shift) + __builtin_ctzll(rot) + 1) << shift;
+
+        if (tick < next) next = tick;
+    }
+
+    return next;
+}
+
+static
+void wheel_cascade(wheel_t *w, unsigned level, unsigned slot) {
+    wheel_node_t list, *n;
+
+    wheel_list_init(&list);
+    list_splice(&list, &w->slot[level][slot]);
+    w->occupied[level] &= ~(1ULL << slot);
+
+    while ((n = wheel_list_pop(&list)))
+        wheel_place(w, n);
+}
+
+void wheel_advance(wheel_t *w, uint64_t now, wheel_node_t *expired) {
+    uint64_t next;
+    unsigned level, slot;
+    wheel_node_t *n;
+
+    while (w->now < now) {
+        next = wheel_next(w);
+
+        /* nothing to be done up to the tick */
+        if (next > now) {
+            w->now = now;
+            break;
+        }
+
+        w->now = next;
+
+        /* higher levels first, their nodes may land at lower ones */
+        for (level = WHEEL_LEVELS - 1; level > 0; --level)
+            if (!(next & ((1ULL << level_shift(level)) - 1)))
+                wheel_cascade(w, level,
+                              (next >> level_shift(level)) & (WHEEL_SLOTS - 1));
+
+        slot = next & (WHEEL_SLOTS - 1);
+
+        for (n = w->slot[0][slot].next; n != &w->slot[0][slot]; n = n->next) {
+            n->linked = false;
+            --w->count;
+        }
+
+        list_splice(expired, &w->slot[0][slot]);
+        w->occupied[0] &= ~(1ULL << slot);
+    }
+}
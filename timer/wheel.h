@@ -0,0 +1,61 @@
+#ifndef _TIMER_WHEEL_H_
+# define _TIMER_WHEEL_H_
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+/* Hashed hierarchical timing wheel.
+ * Level k slot covers 64^k ticks. Node is placed at the lowest level its
+ * expiry fits into relative to current tick and is cascaded to lower
+ * levels as time advances. Nodes beyond the highest level are placed at
+ * its farthest slot and re-placed on cascade.
+ * Occupied slots are tracked with bitmaps, so the next tick something is
+ * to be done at is found with a couple of bit operations per level.
+ */
+
+# define WHEEL_LEVELS 4
+# define WHEEL_SLOT_BITS 6
+# define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+# define WHEEL_NEVER UINT64_MAX
+
+typedef struct wheel_node {
+    struct wheel_node *prev;
+    struct wheel_node *next;
+    uint64_t expires;                                       ///< tick to expire at
+    uint8_t level;
+    uint8_t slot;
+    bool linked;                                            ///< node is in the wheel
+} wheel_node_t;
+
+typedef struct wheel {
+    uint64_t now;                                           ///< last processed tick
+    size_t count;                                           ///< nodes in the wheel
+    uint64_t occupied[WHEEL_LEVELS];                        ///< bitmap of non-empty slots
+    wheel_node_t slot[WHEEL_LEVELS][WHEEL_SLOTS];           ///< list heads
+} wheel_t;
+
+void wheel_init(wheel_t *w, uint64_t now);
+void wheel_node_init(wheel_node_t *n);
+/** Add node to expire at tick, ticks not after current one are moved to
+ * the next tick
+ */
+void wheel_add(wheel_t *w, wheel_node_t *n, uint64_t expires);
+void wheel_del(wheel_t *w, wheel_node_t *n);
+/** Next tick the wheel should be advanced at, \c WHEEL_NEVER if empty
+ * This is either expiry of a node or cascade of higher level slot.
+ */
+uint64_t wheel_next(const wheel_t *w);
+/** Advance wheel up to tick
+ * Expired nodes are unlinked from the wheel and appended to \c expired
+ * list head in order of expiry.
+ */
+void wheel_advance(wheel_t *w, uint64_t now, wheel_node_t *expired);
+
+/* list helpers, list head is a node linked to itself */
+void wheel_list_init(wheel_node_t *head);
+bool wheel_list_empty(const wheel_node_t *head);
+/* unlink and return first node of list, NULL if empty */
+wheel_node_t *wheel_list_pop(wheel_node_t *head);
+
+#endif /* _TIMER_WHEEL_H_ */